@@ -4,6 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
 #include <stdexcept>
 #include <algorithm>
 #include <cmath>
@@ -11,11 +12,12 @@
 #include <functional>
 using namespace std;
 
-map<string, int> label_address_map = {};
-vector<pair<int, string>> input_file_instr;
-vector<string> input_data_file_instr;
-vector<string> memory;
-vector<string> machine_codes;
+// Scratch state of assemble(), per thread so simulators on different threads can assemble at once
+thread_local map<string, int> label_address_map = {};
+thread_local vector<pair<int, string>> input_file_instr;
+thread_local vector<string> input_data_file_instr;
+thread_local vector<string> memory;
+thread_local vector<string> machine_codes;
 
 vector<string> convert_to_fixed_hex(const string &input, const string &directive) 
 {
@@ -180,7 +182,7 @@ vector<string> convert_to_fixed_hex(const string &input, const string &directive
 
 // Us while writing this code- https://i.pinimg.com/originals/26/b2/50/26b250a738ea4abc7a5af4d42ad93af0.jpg
 
-map<string, string> opcode_map = 
+unordered_map<string, string> opcode_map = 
 {
     // R-format
     {"add", "0110011"}, {"and", "0110011"}, {"or", "0110011"}, {"sll", "0110011"},
@@ -205,7 +207,7 @@ map<string, string> opcode_map =
     {"jal", "1101111"}
 };
 
-map<string, string> func3_map  = 
+unordered_map<string, string> func3_map  = 
 {
     // R-format
     {"add", "000"}, {"and", "111"}, {"or", "110"}, {"sll", "001"},
@@ -225,7 +227,7 @@ map<string, string> func3_map  =
     
 };
 
-map<string, string> func7_map = 
+unordered_map<string, string> func7_map = 
 {
     {"add", "0000000"}, {"and", "0000000"}, {"or", "0000000"}, {"sll", "0000000"},
     {"slt", "0000000"}, {"sra", "0100000"}, {"srl", "0000000"}, {"sub", "0100000"},
@@ -560,7 +562,7 @@ string I(int address, string instr)
 }
 
 
-map<string, function<string(int, string)>> instructionType =
+unordered_map<string, function<string(int, string)>> instructionType =
 {
     //R-format
     {"add", R}, {"and", R}, {"or", R}, {"sll", R},
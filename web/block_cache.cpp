@@ -0,0 +1,276 @@
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Basic block translation shared by the functional engines. A block is the straight-line run
+// of instructions starting at an entry pc and ending with the first branch, jal or jalr. It is
+// translated once into micro-ops and cached by entry pc. Frequent pairs are fused into single
+// micro-ops: lui+addi (li of a 32 bit constant), auipc+jalr (far call) and addi+branch (loop
+// counter update and test).
+//
+// Instructions the generic executor cannot run (ecall, unknown encodings, ld/sd, words that are
+// missing or partly written) are never put in a block; a block ends before them, so an empty
+// block tells the caller to handle the instruction at that pc itself.
+//
+// The executor is a template over the machine, which supplies:
+//   uint32_t regs[32];
+//   const blocks::micro_op *at;                     // set before each micro-op runs
+//   bool stop;                                      // set by store() to leave the block early
+//   void write(uint8_t rd, uint32_t value);
+//   uint32_t link(uint32_t return_address);         // value jal/jalr write to rd
+//   uint32_t load(const micro_op &op, uint32_t address);
+//   void store(const micro_op &op, uint32_t address, uint32_t value);
+//   void retire(const micro_op &op);                // after each micro-op completes
+namespace blocks
+{
+    enum class UOp : uint8_t
+    {
+        Alu, AluImm, Load, Store, Beq, Bne, Blt, Bge, Lui, Auipc, Jal, Jalr,
+        LuiAddi, AuipcJalr, AddiBeq, AddiBne, AddiBlt, AddiBge
+    };
+
+    struct micro_op
+    {
+        UOp kind;
+        isa::Op op;       // operation of the first instruction
+        uint8_t count;    // instructions covered, 2 for fused pairs
+        uint8_t funct3;
+        uint8_t rd, rs1, rs2;
+        uint8_t rd2, rs1b, rs2b; // second instruction of a fused pair
+        uint32_t pc, imm, imm2;
+    };
+
+    struct block
+    {
+        uint32_t entry = 0;
+        uint32_t count = 0; // instructions in the block
+        vector<micro_op> ops;
+    };
+
+    const uint32_t MAX_BLOCK = 64;
+
+    bool ends_block(UOp kind)
+    {
+        return (kind >= UOp::Beq && kind <= UOp::Bge) || kind == UOp::Jal || kind == UOp::Jalr;
+    }
+
+    // Single instruction micro-op, false for the instructions blocks leave to the caller
+    bool translate(uint32_t pc, uint32_t instr, micro_op &u)
+    {
+        u = micro_op();
+        u.op = isa::instruction_type(instr);
+        u.count = 1;
+        u.funct3 = (instr >> 12) & 7;
+        u.rd = (instr >> 7) & 0x1F;
+        u.rs1 = (instr >> 15) & 0x1F;
+        u.rs2 = (instr >> 20) & 0x1F;
+        u.pc = pc;
+        u.imm = isa::immediate(instr);
+
+        uint32_t ignored;
+        switch (instr & 0x7F)
+        {
+        case isa::OP_R:
+        case isa::OP_I:
+            if (!isa::compute(u.op, 0, 1, ignored))
+                return false;
+            u.kind = (instr & 0x7F) == isa::OP_R ? UOp::Alu : UOp::AluImm;
+            return true;
+        case isa::OP_LOAD:
+            u.kind = UOp::Load;
+            return u.funct3 != 3;
+        case isa::OP_STORE:
+            u.kind = UOp::Store;
+            return u.funct3 != 3;
+        case isa::OP_BRANCH:
+            if (u.op == isa::Op::Unknown)
+                return false;
+            u.kind = u.op == isa::Op::Beq ? UOp::Beq : u.op == isa::Op::Bne ? UOp::Bne : u.op == isa::Op::Blt ? UOp::Blt : UOp::Bge;
+            return true;
+        case isa::OP_LUI:
+            u.kind = UOp::Lui;
+            return true;
+        case isa::OP_AUIPC:
+            u.kind = UOp::Auipc;
+            return true;
+        case isa::OP_JAL:
+            u.kind = UOp::Jal;
+            return true;
+        case isa::OP_JALR:
+            u.kind = UOp::Jalr;
+            return true;
+        }
+        return false;
+    }
+
+    // Folds next into prev when the pair has a superinstruction
+    bool fuse(micro_op &prev, const micro_op &next)
+    {
+        if (prev.count != 1)
+            return false;
+
+        bool next_is_addi = next.kind == UOp::AluImm && next.op == isa::Op::Add;
+        bool prev_is_addi = prev.kind == UOp::AluImm && prev.op == isa::Op::Add;
+        if (prev.kind == UOp::Lui && next_is_addi && next.rs1 == prev.rd)
+            prev.kind = UOp::LuiAddi;
+        else if (prev.kind == UOp::Auipc && next.kind == UOp::Jalr && next.rs1 == prev.rd)
+            prev.kind = UOp::AuipcJalr;
+        else if (prev_is_addi && next.kind >= UOp::Beq && next.kind <= UOp::Bge)
+            prev.kind = static_cast<UOp>(static_cast<int>(UOp::AddiBeq) + (static_cast<int>(next.kind) - static_cast<int>(UOp::Beq)));
+        else
+            return false;
+
+        prev.count = 2;
+        prev.rd2 = next.rd;
+        prev.rs1b = next.rs1;
+        prev.rs2b = next.rs2;
+        prev.imm2 = next.imm;
+        return true;
+    }
+
+    // Translates the block at pc; with limit 1 it is just that instruction, unfused
+    block build(uint32_t pc, const PagedMemory &text, uint32_t limit = MAX_BLOCK)
+    {
+        block b;
+        b.entry = pc;
+        while (b.count < limit)
+        {
+            uint32_t instr;
+            micro_op u;
+            if (static_cast<int32_t>(pc) >= 0x10000000 || text.read(pc, 4, instr) != 4 || !translate(pc, instr, u))
+                break;
+
+            if (b.ops.empty() || limit == 1 || !fuse(b.ops.back(), u))
+                b.ops.push_back(u);
+            b.count++;
+            pc += 4;
+            if (ends_block(u.kind))
+                break;
+        }
+        return b;
+    }
+
+    class block_cache
+    {
+        unordered_map<uint32_t, block> blocks;
+        unsigned version = 0;
+
+    public:
+        // text_version must change whenever the text segment is written
+        const block &lookup(uint32_t pc, const PagedMemory &text, unsigned text_version)
+        {
+            if (version != text_version)
+            {
+                blocks.clear();
+                version = text_version;
+            }
+
+            auto it = blocks.find(pc);
+            if (it == blocks.end())
+                it = blocks.emplace(pc, build(pc, text)).first;
+            return it->second;
+        }
+
+        void clear()
+        {
+            blocks.clear();
+        }
+    };
+
+    bool branch_taken(UOp kind, uint32_t a, uint32_t b)
+    {
+        switch (kind)
+        {
+        case UOp::Beq:
+        case UOp::AddiBeq:
+            return a == b;
+        case UOp::Bne:
+        case UOp::AddiBne:
+            return a != b;
+        case UOp::Blt:
+        case UOp::AddiBlt:
+            return static_cast<int32_t>(a) < static_cast<int32_t>(b);
+        default:
+            return static_cast<int32_t>(a) >= static_cast<int32_t>(b);
+        }
+    }
+
+    // Runs a whole block and returns the pc that follows it
+    template <class M>
+    uint32_t execute(M &m, const block &b)
+    {
+        uint32_t result;
+        for (const micro_op &u : b.ops)
+        {
+            m.at = &u;
+            switch (u.kind)
+            {
+            case UOp::Alu:
+                isa::compute(u.op, m.regs[u.rs1], m.regs[u.rs2], result);
+                m.write(u.rd, result);
+                break;
+            case UOp::AluImm:
+                isa::compute(u.op, m.regs[u.rs1], u.imm, result);
+                m.write(u.rd, result);
+                break;
+            case UOp::Load:
+                m.write(u.rd, m.load(u, m.regs[u.rs1] + u.imm));
+                break;
+            case UOp::Store:
+                m.store(u, m.regs[u.rs1] + u.imm, m.regs[u.rs2]);
+                if (m.stop)
+                {
+                    m.retire(u);
+                    return u.pc + 4;
+                }
+                break;
+            case UOp::Beq:
+            case UOp::Bne:
+            case UOp::Blt:
+            case UOp::Bge:
+                m.retire(u);
+                return branch_taken(u.kind, m.regs[u.rs1], m.regs[u.rs2]) ? u.pc + u.imm : u.pc + 4;
+            case UOp::Lui:
+                m.write(u.rd, u.imm);
+                break;
+            case UOp::Auipc:
+                m.write(u.rd, u.pc + u.imm);
+                break;
+            case UOp::Jal:
+                m.write(u.rd, m.link(u.pc + 4));
+                m.retire(u);
+                return u.pc + u.imm;
+            case UOp::Jalr:
+            {
+                uint32_t target = m.regs[u.rs1] + u.imm;
+                m.write(u.rd, m.link(u.pc + 4));
+                m.retire(u);
+                return target;
+            }
+            case UOp::LuiAddi:
+                m.write(u.rd, u.imm);
+                m.write(u.rd2, m.regs[u.rs1b] + u.imm2);
+                break;
+            case UOp::AuipcJalr:
+            {
+                m.write(u.rd, u.pc + u.imm);
+                uint32_t target = m.regs[u.rs1b] + u.imm2;
+                m.write(u.rd2, m.link(u.pc + 8));
+                m.retire(u);
+                return target;
+            }
+            case UOp::AddiBeq:
+            case UOp::AddiBne:
+            case UOp::AddiBlt:
+            case UOp::AddiBge:
+                m.write(u.rd, m.regs[u.rs1] + u.imm);
+                m.retire(u);
+                return branch_taken(u.kind, m.regs[u.rs1b], m.regs[u.rs2b]) ? u.pc + 4 + u.imm2 : u.pc + 8;
+            }
+            m.retire(u);
+        }
+        return b.entry + 4 * b.count;
+    }
+}
@@ -0,0 +1,664 @@
+#include <algorithm>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Branch predictors for the fast pipelined engine, all with flat power-of-two tables indexed by
+// pc bits and global history, so they alias and run out of space like hardware tables do and a
+// lookup is a few masks and array reads. A predictor is a branch target buffer that says which
+// pcs are branches and where they went, combined with a direction component that says whether
+// to take them, plus an optional return address stack for function returns;
+// fast::BranchPredictor puts them together. Direction components supply
+// resize(table_bits, history_bits), clear(), predict(pc) and update(pc, taken). History is
+// updated when a branch resolves rather than speculatively at fetch.
+namespace predictors
+{
+    enum class Kind : uint8_t
+    {
+        OneBit, Bimodal, GShare, Tournament, Tage
+    };
+
+    const int KINDS = 5;
+    const char *const KIND_NAMES[KINDS] = {"1bit", "bimodal", "gshare", "tournament", "tage"};
+
+    enum class Replacement : uint8_t
+    {
+        Lru, Random
+    };
+
+    struct btb_config
+    {
+        unsigned entries = 0; // a power of two; 0 keeps the predictor's own, see fast::BranchPredictor
+        unsigned ways = 1;
+        unsigned tag_bits = 0; // 0 compares every bit above the set index
+        Replacement replacement = Replacement::Lru;
+    };
+
+    struct config
+    {
+        Kind kind = Kind::OneBit;
+        unsigned table_bits = 10;   // log2 of the entries of each table
+        unsigned history_bits = 12; // global history length
+        btb_config btb;
+        unsigned ras_depth = 0; // return address stack entries, 0 for none
+    };
+
+    const unsigned MIN_TABLE_BITS = 4, MAX_TABLE_BITS = 20;
+    const unsigned MAX_HISTORY_BITS = 64;
+    const unsigned MAX_BTB_ENTRIES = 1u << 16, MAX_BTB_WAYS = 64;
+    const unsigned MAX_RAS_DEPTH = 1024;
+
+    inline uint32_t word_index(uint32_t pc)
+    {
+        return pc >> 2;
+    }
+
+    // The low length bits of history xor-folded down to bits bits
+    inline uint32_t fold(uint64_t history, unsigned length, unsigned bits)
+    {
+        if (length < 64)
+            history &= (1ull << length) - 1;
+        uint32_t folded = 0;
+        for (; history; history >>= bits)
+            folded ^= static_cast<uint32_t>(history & ((1ull << bits) - 1));
+        return folded;
+    }
+
+    // Saturating 2 bit counters, taken from 2 up
+    struct counter_table
+    {
+        vector<uint8_t> counters;
+        uint32_t mask = 0;
+
+        void resize(unsigned bits)
+        {
+            counters.assign(size_t(1) << bits, 1);
+            mask = (1u << bits) - 1;
+        }
+
+        void clear()
+        {
+            fill(counters.begin(), counters.end(), 1);
+        }
+
+        bool taken(uint32_t index) const
+        {
+            return counters[index & mask] >= 2;
+        }
+
+        void train(uint32_t index, bool taken)
+        {
+            uint8_t &c = counters[index & mask];
+            if (taken && c < 3)
+                c++;
+            else if (!taken && c > 0)
+                c--;
+        }
+    };
+
+    struct btb_counters
+    {
+        uint64_t hits = 0, misses = 0; // of the branches and jumps resolved
+        uint64_t evictions = 0;        // valid entries replaced
+    };
+
+    // Set-associative branch target buffer on one flat array, set i being entries
+    // [i * ways, (i + 1) * ways). The set is picked by the low bits of the word address and the
+    // entry by tag_bits bits above them, so with short tags different branches share an entry.
+    // Only taken branches are entered; a full set gives up its least recently used entry or a
+    // random one. Lookups scan one set, so their cost depends on the ways only.
+    class target_buffer
+    {
+        struct entry
+        {
+            uint32_t tag, target;
+            uint32_t pc; // of the branch entered last, for display
+            bool valid;
+            uint64_t used; // LRU stamp
+        };
+
+        vector<entry> entries;
+        unsigned ways = 1, set_bits = 0;
+        uint32_t tag_mask = 0;
+        Replacement replacement = Replacement::Lru;
+        uint64_t clock = 0;
+        uint32_t seed = 1; // xorshift state for random replacement, so runs repeat
+
+        // index of the first entry of pc's set
+        size_t set_of(uint32_t pc, uint32_t &tag) const
+        {
+            uint32_t w = word_index(pc);
+            tag = (w >> set_bits) & tag_mask;
+            return size_t(w & ((1u << set_bits) - 1)) * ways;
+        }
+
+        const entry *match(uint32_t pc) const
+        {
+            uint32_t tag;
+            const entry *set = &entries[set_of(pc, tag)];
+            for (unsigned i = 0; i < ways; i++)
+                if (set[i].valid && set[i].tag == tag)
+                    return &set[i];
+            return nullptr;
+        }
+
+        entry *match(uint32_t pc)
+        {
+            return const_cast<entry *>(static_cast<const target_buffer *>(this)->match(pc));
+        }
+
+        entry *victim(entry *set)
+        {
+            for (unsigned i = 0; i < ways; i++)
+                if (!set[i].valid)
+                    return &set[i];
+            counters.evictions++;
+            if (replacement == Replacement::Random)
+            {
+                seed ^= seed << 13;
+                seed ^= seed >> 17;
+                seed ^= seed << 5;
+                return &set[seed & (ways - 1)];
+            }
+            entry *oldest = set;
+            for (unsigned i = 1; i < ways; i++)
+                if (set[i].used < oldest->used)
+                    oldest = &set[i];
+            return oldest;
+        }
+
+    public:
+        btb_counters counters;
+
+        // entries and ways are powers of two with ways <= entries
+        void configure(const btb_config &c)
+        {
+            entries.assign(c.entries, entry());
+            ways = c.ways;
+            set_bits = 0;
+            while ((1u << set_bits) * ways < c.entries)
+                set_bits++;
+            unsigned above = 30 - set_bits; // bits of a word address above the set index
+            tag_mask = c.tag_bits && c.tag_bits < above ? (1u << c.tag_bits) - 1 : ~0u;
+            replacement = c.replacement;
+            clear();
+        }
+
+        void clear()
+        {
+            fill(entries.begin(), entries.end(), entry());
+            counters = btb_counters();
+            clock = 0;
+            seed = 1;
+        }
+
+        const uint32_t *find(uint32_t pc) const
+        {
+            const entry *e = match(pc);
+            return e ? &e->target : nullptr;
+        }
+
+        // find for a fetch, which makes the entry the most recently used
+        const uint32_t *lookup(uint32_t pc)
+        {
+            entry *e = match(pc);
+            if (!e)
+                return nullptr;
+            e->used = ++clock;
+            return &e->target;
+        }
+
+        void resolve(uint32_t pc, bool taken, uint32_t target)
+        {
+            entry *e = match(pc);
+            if (e)
+                counters.hits++;
+            else
+                counters.misses++;
+            if (!taken)
+                return;
+            if (!e)
+            {
+                uint32_t tag;
+                e = victim(&entries[set_of(pc, tag)]);
+                e->tag = tag;
+                e->valid = true;
+            }
+            e->target = target;
+            e->pc = pc;
+            e->used = ++clock;
+        }
+
+        template <class F>
+        void for_each(F f) const
+        {
+            for (const entry &e : entries)
+                if (e.valid)
+                    f(e.pc, e.target);
+        }
+    };
+
+    // What fetch did with the return address stack for an instruction, carried down the pipeline
+    // so the outcome is counted once the instruction resolves
+    enum class Link : uint8_t
+    {
+        None, Call, CallOverflow, Return, ReturnEmpty
+    };
+
+    struct ras_counters
+    {
+        uint64_t calls = 0, returns = 0;
+        uint64_t correct = 0, incorrect = 0; // returns predicted from the stack
+        uint64_t overflows = 0;              // calls that dropped the oldest entry
+        uint64_t underflows = 0;             // returns fetched with the stack empty
+    };
+
+    // Circular return address stack. jal/jalr with rd = x1 push the address after them and
+    // jalr x0, x1, 0 pops its predicted target; a push onto a full stack overwrites the oldest
+    // entry and a pop from an empty one predicts nothing. Fetch takes a checkpoint before each
+    // instruction and a flush restores the checkpoint of the first squashed one. That is the top
+    // pointer, the count and the one slot a push would overwrite, which is exact as long as no
+    // more than one push or pop happens on the wrong path.
+    class return_stack
+    {
+        vector<uint32_t> slots;
+        uint32_t top = 0, count = 0; // top is the slot the next push writes
+
+    public:
+        struct checkpoint
+        {
+            uint32_t top = 0, count = 0, slot = 0;
+        };
+
+        ras_counters counters;
+
+        void configure(unsigned depth)
+        {
+            slots.assign(depth, 0);
+            clear();
+        }
+
+        void clear()
+        {
+            fill(slots.begin(), slots.end(), 0);
+            top = count = 0;
+            counters = ras_counters();
+        }
+
+        bool enabled() const
+        {
+            return !slots.empty();
+        }
+
+        checkpoint save() const
+        {
+            checkpoint c;
+            c.top = top;
+            c.count = count;
+            c.slot = slots[top];
+            return c;
+        }
+
+        void repair(const checkpoint &c)
+        {
+            top = c.top;
+            count = c.count;
+            slots[top] = c.slot;
+        }
+
+        static bool is_call(uint32_t instr)
+        {
+            uint32_t opcode = instr & 0x7F;
+            return (opcode == 0x6F || opcode == 0x67) && (instr >> 7 & 31) == 1;
+        }
+
+        static bool is_return(uint32_t instr)
+        {
+            return instr == 0x00008067; // jalr x0, x1, 0
+        }
+
+        // Pushes or pops for the instruction fetched at pc; a pop from a non-empty stack sets target
+        Link fetched(uint32_t pc, uint32_t instr, uint32_t &target)
+        {
+            if (is_return(instr))
+            {
+                if (!count)
+                    return Link::ReturnEmpty;
+                top = (top + uint32_t(slots.size()) - 1) % slots.size();
+                count--;
+                target = slots[top];
+                return Link::Return;
+            }
+            if (!is_call(instr))
+                return Link::None;
+            bool full = count == slots.size();
+            slots[top] = pc + 4;
+            top = (top + 1) % slots.size();
+            if (!full)
+                count++;
+            return full ? Link::CallOverflow : Link::Call;
+        }
+
+        // Counts an instruction that reached execute, correct telling whether fetch went on at its target
+        void resolved(Link link, bool correct)
+        {
+            if (link == Link::Call || link == Link::CallOverflow)
+            {
+                counters.calls++;
+                if (link == Link::CallOverflow)
+                    counters.overflows++;
+            }
+            else if (link == Link::Return)
+            {
+                counters.returns++;
+                if (correct)
+                    counters.correct++;
+                else
+                    counters.incorrect++;
+            }
+            else if (link == Link::ReturnEmpty)
+            {
+                counters.returns++;
+                counters.underflows++;
+            }
+        }
+    };
+
+    // 2 bit counter per pc
+    class bimodal
+    {
+        counter_table table;
+
+    public:
+        void resize(unsigned table_bits, unsigned)
+        {
+            table.resize(table_bits);
+        }
+
+        void clear()
+        {
+            table.clear();
+        }
+
+        bool predict(uint32_t pc) const
+        {
+            return table.taken(word_index(pc));
+        }
+
+        void update(uint32_t pc, bool taken)
+        {
+            table.train(word_index(pc), taken);
+        }
+    };
+
+    // 2 bit counters indexed by pc xor global history
+    class gshare
+    {
+        counter_table table;
+        unsigned table_bits = 0, history_bits = 0;
+        uint64_t history = 0;
+
+        uint32_t index(uint32_t pc) const
+        {
+            return word_index(pc) ^ fold(history, history_bits, table_bits);
+        }
+
+    public:
+        void resize(unsigned table_bits, unsigned history_bits)
+        {
+            table.resize(table_bits);
+            this->table_bits = table_bits;
+            this->history_bits = history_bits;
+            history = 0;
+        }
+
+        void clear()
+        {
+            table.clear();
+            history = 0;
+        }
+
+        bool predict(uint32_t pc) const
+        {
+            return table.taken(index(pc));
+        }
+
+        void update(uint32_t pc, bool taken)
+        {
+            table.train(index(pc), taken);
+            history = history << 1 | taken;
+        }
+    };
+
+    // bimodal and gshare, with a table of 2 bit counters per pc choosing between them
+    class tournament
+    {
+        bimodal local;
+        gshare global;
+        counter_table chooser; // taken means use gshare
+
+    public:
+        void resize(unsigned table_bits, unsigned history_bits)
+        {
+            local.resize(table_bits, history_bits);
+            global.resize(table_bits, history_bits);
+            chooser.resize(table_bits);
+        }
+
+        void clear()
+        {
+            local.clear();
+            global.clear();
+            chooser.clear();
+        }
+
+        bool predict(uint32_t pc) const
+        {
+            return chooser.taken(word_index(pc)) ? global.predict(pc) : local.predict(pc);
+        }
+
+        void update(uint32_t pc, bool taken)
+        {
+            bool local_right = local.predict(pc) == taken, global_right = global.predict(pc) == taken;
+            if (local_right != global_right)
+                chooser.train(word_index(pc), global_right);
+            local.update(pc, taken);
+            global.update(pc, taken);
+        }
+    };
+
+    // A small TAGE: a bimodal base and TABLES tagged tables indexed with geometrically longer
+    // history (history_bits / 8, / 4, / 2 and all of it). The table with the longest history
+    // whose tag matches provides the prediction; a misprediction allocates an entry in a longer
+    // table. Each tagged table has a quarter of the base table's entries.
+    class tage
+    {
+        static const unsigned TABLES = 4;
+        static const unsigned TAG_BITS = 9;
+        static const uint16_t EMPTY = 0xFFFF; // matches no tag
+
+        struct entry
+        {
+            uint16_t tag;
+            int8_t counter; // 3 bit signed, taken from 0 up
+            uint8_t useful; // 2 bit
+        };
+
+        counter_table base;
+        vector<entry> tables[TABLES];
+        unsigned index_bits = 0;
+        unsigned lengths[TABLES] = {};
+        uint64_t history = 0;
+
+        uint32_t index(unsigned t, uint32_t pc) const
+        {
+            uint32_t w = word_index(pc);
+            return (w ^ (w >> index_bits) ^ fold(history, lengths[t], index_bits)) & ((1u << index_bits) - 1);
+        }
+
+        uint16_t tag(unsigned t, uint32_t pc) const
+        {
+            uint32_t h = fold(history, lengths[t], TAG_BITS) ^ (fold(history, lengths[t], TAG_BITS - 1) << 1);
+            return static_cast<uint16_t>((word_index(pc) ^ h) & ((1u << TAG_BITS) - 1));
+        }
+
+        // the table with the longest history that hits, TABLES if none does
+        unsigned provider(uint32_t pc, unsigned below = TABLES) const
+        {
+            for (unsigned t = below; t-- > 0;)
+                if (tables[t][index(t, pc)].tag == tag(t, pc))
+                    return t;
+            return TABLES;
+        }
+
+        bool prediction(unsigned t, uint32_t pc) const
+        {
+            return t < TABLES ? tables[t][index(t, pc)].counter >= 0 : base.taken(word_index(pc));
+        }
+
+    public:
+        void resize(unsigned table_bits, unsigned history_bits)
+        {
+            base.resize(table_bits);
+            index_bits = table_bits - 2;
+            for (unsigned t = 0; t < TABLES; t++)
+            {
+                lengths[t] = max(1u, history_bits >> (TABLES - 1 - t));
+                tables[t].assign(size_t(1) << index_bits, entry{EMPTY, 0, 0});
+            }
+            history = 0;
+        }
+
+        void clear()
+        {
+            base.clear();
+            for (unsigned t = 0; t < TABLES; t++)
+                fill(tables[t].begin(), tables[t].end(), entry{EMPTY, 0, 0});
+            history = 0;
+        }
+
+        bool predict(uint32_t pc) const
+        {
+            return prediction(provider(pc), pc);
+        }
+
+        void update(uint32_t pc, bool taken)
+        {
+            unsigned p = provider(pc);
+            bool predicted = prediction(p, pc);
+            if (p < TABLES)
+            {
+                entry &e = tables[p][index(p, pc)];
+                bool alternate = prediction(provider(pc, p), pc);
+                if (alternate != predicted)
+                    e.useful = predicted == taken ? min(e.useful + 1, 3) : max(e.useful - 1, 0);
+                e.counter = taken ? min(e.counter + 1, 3) : max(e.counter - 1, -4);
+            }
+            else
+                base.train(word_index(pc), taken);
+
+            // a misprediction claims an entry in a table with longer history than the provider
+            unsigned first = p == TABLES ? 0 : p + 1;
+            if (predicted != taken && first < TABLES)
+            {
+                bool allocated = false;
+                for (unsigned t = first; t < TABLES && !allocated; t++)
+                {
+                    entry &e = tables[t][index(t, pc)];
+                    if (e.useful == 0)
+                    {
+                        e = {tag(t, pc), static_cast<int8_t>(taken ? 0 : -1), 0};
+                        allocated = true;
+                    }
+                }
+                if (!allocated)
+                    for (unsigned t = first; t < TABLES; t++)
+                    {
+                        entry &e = tables[t][index(t, pc)];
+                        if (e.useful)
+                            e.useful--;
+                    }
+            }
+            history = history << 1 | taken;
+        }
+    };
+
+    // The direction component picked by config.kind, switched on at each lookup rather than
+    // being a template parameter so the engine is instantiated once for all of them
+    class direction_predictor
+    {
+        Kind kind = Kind::Bimodal;
+        bimodal bimodal_;
+        gshare gshare_;
+        tournament tournament_;
+        tage tage_; // only the component in use has tables
+
+    public:
+        // has no tables until configured
+        void configure(const config &c)
+        {
+            kind = c.kind == Kind::OneBit ? Kind::Bimodal : c.kind;
+            bimodal_ = bimodal();
+            gshare_ = gshare();
+            tournament_ = tournament();
+            tage_ = tage();
+            switch (kind)
+            {
+            case Kind::GShare:
+                gshare_.resize(c.table_bits, c.history_bits);
+                break;
+            case Kind::Tournament:
+                tournament_.resize(c.table_bits, c.history_bits);
+                break;
+            case Kind::Tage:
+                tage_.resize(c.table_bits, c.history_bits);
+                break;
+            default:
+                bimodal_.resize(c.table_bits, c.history_bits);
+            }
+        }
+
+        void clear()
+        {
+            bimodal_.clear();
+            gshare_.clear();
+            tournament_.clear();
+            tage_.clear();
+        }
+
+        bool predict(uint32_t pc) const
+        {
+            switch (kind)
+            {
+            case Kind::GShare:
+                return gshare_.predict(pc);
+            case Kind::Tournament:
+                return tournament_.predict(pc);
+            case Kind::Tage:
+                return tage_.predict(pc);
+            default:
+                return bimodal_.predict(pc);
+            }
+        }
+
+        void update(uint32_t pc, bool taken)
+        {
+            switch (kind)
+            {
+            case Kind::GShare:
+                gshare_.update(pc, taken);
+                break;
+            case Kind::Tournament:
+                tournament_.update(pc, taken);
+                break;
+            case Kind::Tage:
+                tage_.update(pc, taken);
+                break;
+            default:
+                bimodal_.update(pc, taken);
+            }
+        }
+    };
+}
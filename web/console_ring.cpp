@@ -0,0 +1,101 @@
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Console of a simulator, bounded to the last `capacity` lines. Text is appended to an open
+// buffer that is cut into lines and moved into a ring once it passes FLUSH_BYTES or the console
+// is read, so tracing only ever appends to a string. Every line gets a sequence number; a reader
+// keeps the number after the last line it saw (its cursor) and asks for what came since, which
+// costs time in the new output only. Lines overwritten or cleared before the reader got to them
+// are reported as dropped. Only complete lines are read; a line without its '\n' waits in open.
+class ConsoleRing
+{
+public:
+    static const uint32_t DEFAULT_CAPACITY = 1u << 16; // lines, a power of two
+    static const size_t FLUSH_BYTES = 1u << 16;
+
+    string open; // appended to directly by the trace code, which then calls settle()
+
+    explicit ConsoleRing(uint32_t capacity = DEFAULT_CAPACITY) : capacity(capacity) {}
+
+    void append(const string &text)
+    {
+        open += text;
+        open += '\n';
+        settle();
+    }
+
+    void settle()
+    {
+        if (open.size() >= FLUSH_BYTES)
+            flush();
+    }
+
+    void clear()
+    {
+        flush();
+        first = next;
+    }
+
+    // Sequence number of the next line, the cursor of a reader that is up to date
+    uint64_t cursor()
+    {
+        flush();
+        return next;
+    }
+
+    // The lines from cursor on that are still held, each followed by '\n'. dropped is set to how
+    // many lines from cursor on are gone; a cursor past the end reads nothing.
+    string read_since(uint64_t cursor, uint64_t &dropped)
+    {
+        flush();
+        cursor = min(cursor, next);
+        dropped = cursor < first ? first - cursor : 0;
+        string text;
+        for (uint64_t i = max(cursor, first); i < next; i++)
+        {
+            text += lines[i & (capacity - 1)];
+            text += '\n';
+        }
+        return text;
+    }
+
+    string read_all()
+    {
+        uint64_t dropped;
+        return read_since(first, dropped);
+    }
+
+private:
+    uint32_t capacity;
+    vector<string> lines; // slot i & (capacity - 1) holds line i; sized on first use
+    uint64_t first = 0;   // oldest line held
+    uint64_t next = 0;
+
+    void flush()
+    {
+        size_t start = 0, end;
+        while ((end = open.find('\n', start)) != string::npos)
+        {
+            if (lines.empty())
+                lines.resize(capacity);
+            lines[next & (capacity - 1)].assign(open, start, end - start); // reuses the slot's buffer
+            next++;
+            start = end + 1;
+        }
+        open.erase(0, start);
+        if (next - first > capacity)
+            first = next - capacity;
+    }
+};
+
+// What readConsoleSince hands to JavaScript. Sequence numbers are doubles there, exact up to 2^53.
+struct ConsoleChunk
+{
+    string text;
+    double cursor;  // pass back to read what follows
+    double dropped; // lines lost between the given cursor and text
+};
@@ -0,0 +1,201 @@
+#include <cstdint>
+
+// Instruction set tables shared by the integer simulator engines: opcodes, the operation enum
+// assigned at decode time and immediate extraction on raw instruction words.
+namespace isa
+{
+    // opcodes
+    const uint32_t OP_R = 0x33, OP_I = 0x13, OP_LOAD = 0x03, OP_STORE = 0x23, OP_BRANCH = 0x63,
+                   OP_LUI = 0x37, OP_AUIPC = 0x17, OP_JAL = 0x6F, OP_JALR = 0x67;
+
+    // instruction type, doubles as the ALU operation
+    enum class Op : uint8_t
+    {
+        None, Add, Sub, And, Or, Xor, Sll, Srl, Sra, Slt, Mul, Div, Rem,
+        Lb, Lh, Lw, Ld, Sb, Sh, Sw, Sd, Beq, Bne, Blt, Bge, Lui, Auipc, Jal, Jalr, Unknown
+    };
+
+    const char *op_name(Op op)
+    {
+        static const char *names[] = {"", "add", "sub", "and", "or", "xor", "sll", "srl", "sra", "slt", "mul", "div", "rem",
+                                      "lb", "lh", "lw", "ld", "sb", "sh", "sw", "sd", "beq", "bne", "blt", "bge",
+                                      "lui", "auipc", "jal", "jalr", "unknown"};
+        return names[static_cast<int>(op)];
+    }
+
+    constexpr Op classify(uint32_t opcode, uint32_t funct3, uint32_t funct7)
+    {
+        switch (opcode)
+        {
+        case OP_R:
+            if (funct3 == 0 && funct7 == 0x00)
+                return Op::Add;
+            if (funct3 == 0 && funct7 == 0x20)
+                return Op::Sub;
+            if (funct3 == 7)
+                return Op::And;
+            if (funct3 == 6 && funct7 == 0x00)
+                return Op::Or;
+            if (funct3 == 4 && funct7 == 0x00)
+                return Op::Xor;
+            if (funct3 == 1 && funct7 == 0x00)
+                return Op::Sll;
+            if (funct3 == 5 && funct7 == 0x00)
+                return Op::Srl;
+            if (funct3 == 5 && funct7 == 0x20)
+                return Op::Sra;
+            if (funct3 == 2)
+                return Op::Slt;
+            if (funct3 == 0 && funct7 == 0x01)
+                return Op::Mul;
+            if (funct3 == 4 && funct7 == 0x01)
+                return Op::Div;
+            if (funct3 == 6 && funct7 == 0x01)
+                return Op::Rem;
+            break;
+        case OP_I:
+            if (funct3 == 0)
+                return Op::Add;
+            if (funct3 == 7)
+                return Op::And;
+            if (funct3 == 6)
+                return Op::Or;
+            if (funct3 == 4)
+                return Op::Xor;
+            if (funct3 == 1)
+                return Op::Sll;
+            if (funct3 == 5 && funct7 == 0x00)
+                return Op::Srl;
+            if (funct3 == 5 && funct7 == 0x20)
+                return Op::Sra;
+            if (funct3 == 2)
+                return Op::Slt;
+            break;
+        case OP_LOAD:
+            if (funct3 <= 3)
+                return static_cast<Op>(static_cast<int>(Op::Lb) + funct3);
+            break;
+        case OP_STORE:
+            if (funct3 <= 3)
+                return static_cast<Op>(static_cast<int>(Op::Sb) + funct3);
+            break;
+        case OP_BRANCH:
+            if (funct3 == 0)
+                return Op::Beq;
+            if (funct3 == 1)
+                return Op::Bne;
+            if (funct3 == 4)
+                return Op::Blt;
+            if (funct3 == 5)
+                return Op::Bge;
+            break;
+        case OP_LUI:
+            return Op::Lui;
+        case OP_AUIPC:
+            return Op::Auipc;
+        case OP_JAL:
+            return Op::Jal;
+        case OP_JALR:
+            return Op::Jalr;
+        }
+        return Op::Unknown;
+    }
+
+    // Classification indexed by opcode, funct3 and a 2 bit class of funct7 (0x00, 0x20, 0x01,
+    // anything else), filled at compile time from classify()
+    struct op_table
+    {
+        Op ops[1 << 12];
+
+        constexpr op_table() : ops()
+        {
+            const uint32_t funct7s[4] = {0x00, 0x20, 0x01, 0x7F};
+            for (uint32_t key = 0; key < (1 << 12); key++)
+                ops[key] = classify(key >> 5, (key >> 2) & 7, funct7s[key & 3]);
+        }
+    };
+
+    constexpr op_table OP_TABLE;
+
+    Op instruction_type(uint32_t instr)
+    {
+        uint32_t funct7 = instr >> 25;
+        uint32_t funct7_class = funct7 == 0x00 ? 0 : funct7 == 0x20 ? 1 : funct7 == 0x01 ? 2 : 3;
+        return OP_TABLE.ops[((instr & 0x7F) << 5) | (((instr >> 12) & 7) << 2) | funct7_class];
+    }
+
+    // sign-extended immediate of an instruction word, 0 for formats without one
+    uint32_t immediate(uint32_t instr)
+    {
+        int32_t s = static_cast<int32_t>(instr);
+        switch (instr & 0x7F)
+        {
+        case OP_I:
+        case OP_LOAD:
+        case OP_JALR:
+            return s >> 20;
+        case OP_STORE:
+            return (static_cast<uint32_t>(s >> 25) << 5) | ((instr >> 7) & 0x1F);
+        case OP_BRANCH:
+            return (static_cast<uint32_t>(s >> 31) << 12) | ((instr & 0x80) << 4) | ((instr >> 20) & 0x7E0) | ((instr >> 7) & 0x1E);
+        case OP_LUI:
+        case OP_AUIPC:
+            return instr & 0xFFFFF000;
+        case OP_JAL:
+        {
+            // the string decoder keeps imm[19:1] and sign-extends from bit 19
+            uint32_t imm = (instr & 0xFF000) | ((instr >> 9) & 0x800) | ((instr >> 20) & 0x7FE);
+            return static_cast<uint32_t>(static_cast<int32_t>(imm << 12) >> 12);
+        }
+        }
+        return 0;
+    }
+
+    // Result of an ALU operation, false when op is not one. Division by zero and the
+    // INT_MIN / -1 overflow give the RISC-V defined results instead of trapping.
+    bool compute(Op op, uint32_t a, uint32_t b, uint32_t &result)
+    {
+        int32_t sa = static_cast<int32_t>(a), sb = static_cast<int32_t>(b);
+        switch (op)
+        {
+        case Op::Add:
+            result = a + b;
+            return true;
+        case Op::Sub:
+            result = a - b;
+            return true;
+        case Op::And:
+            result = a & b;
+            return true;
+        case Op::Or:
+            result = a | b;
+            return true;
+        case Op::Xor:
+            result = a ^ b;
+            return true;
+        case Op::Sll:
+            result = a << (b & 31);
+            return true;
+        case Op::Srl:
+            result = a >> (b & 31);
+            return true;
+        case Op::Sra:
+            result = static_cast<uint32_t>(sa >> (b & 31));
+            return true;
+        case Op::Slt:
+            result = sa < sb ? 1 : 0;
+            return true;
+        case Op::Mul:
+            result = a * b;
+            return true;
+        case Op::Div:
+            result = sb == 0 ? 0xFFFFFFFF : (sa == INT32_MIN && sb == -1) ? a : static_cast<uint32_t>(sa / sb);
+            return true;
+        case Op::Rem:
+            result = sb == 0 ? a : (sa == INT32_MIN && sb == -1) ? 0 : static_cast<uint32_t>(sa % sb);
+            return true;
+        default:
+            return false;
+        }
+    }
+}
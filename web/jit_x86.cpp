@@ -0,0 +1,549 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__x86_64__) && defined(__linux__)
+#include <sys/mman.h>
+#define JIT_X86_64 1
+#endif
+
+using namespace std;
+
+// Functional execution of the text segment for the native build, with an optional x86-64 JIT.
+// Blocks from block_cache.cpp are interpreted until their entry has been reached HOT_THRESHOLD
+// times, then translated to machine code in an executable buffer. Guest registers stay in
+// state::regs, loads and stores call back into the host which does the checks, and a block that
+// ends in a branch or jal jumps straight into the translated target once it exists.
+//
+// Translated code assumes stores never write the text segment (true for PMI_data, which rejects
+// them); call engine::flush() if the text changes anyway.
+namespace jit
+{
+    struct state
+    {
+        uint32_t regs[32] = {};
+        uint64_t budget = 0; // instructions left to run, a block only starts when all of it fits
+        uint32_t fault = 0;  // set by load/store when the access failed, the run stops there
+        void *host = nullptr;
+        uint32_t (*load)(state &s, uint32_t funct3, uint32_t address) = nullptr;
+        void (*store)(state &s, uint32_t funct3, uint32_t address, uint32_t value) = nullptr;
+    };
+
+    struct fault_error
+    {
+    };
+
+    // blocks::execute machine for the blocks that are not translated
+    struct interp_machine
+    {
+        uint32_t *regs = nullptr;
+        const blocks::micro_op *at = nullptr;
+        bool stop = false;
+        state *s = nullptr;
+
+        void write(uint8_t rd, uint32_t value)
+        {
+            if (rd != 0)
+                regs[rd] = value;
+        }
+
+        uint32_t link(uint32_t return_address)
+        {
+            return return_address;
+        }
+
+        uint32_t load(const blocks::micro_op &op, uint32_t address)
+        {
+            uint32_t value = s->load(*s, op.funct3, address);
+            if (s->fault)
+                throw fault_error();
+            return value;
+        }
+
+        void store(const blocks::micro_op &op, uint32_t address, uint32_t value)
+        {
+            s->store(*s, op.funct3, address, value);
+            if (s->fault)
+                throw fault_error();
+        }
+
+        void retire(const blocks::micro_op &op)
+        {
+            s->budget -= op.count;
+        }
+    };
+
+    // div and rem go through here so the translated code shares the RISC-V edge cases
+    uint32_t divide(uint32_t op, uint32_t a, uint32_t b)
+    {
+        uint32_t result = 0;
+        isa::compute(static_cast<isa::Op>(op), a, b, result);
+        return result;
+    }
+
+    class engine
+    {
+    public:
+        static const uint32_t HOT_THRESHOLD = 32;
+
+        explicit engine(const PagedMemory &text, bool enable_jit = true) : text(text)
+        {
+#ifdef JIT_X86_64
+            if (enable_jit)
+            {
+                void *p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+                if (p != MAP_FAILED)
+                {
+                    code = static_cast<uint8_t *>(p);
+                    emit_trampoline();
+                }
+            }
+#endif
+        }
+
+        ~engine()
+        {
+#ifdef JIT_X86_64
+            if (code)
+                munmap(code, CODE_SIZE);
+#endif
+        }
+
+        engine(const engine &) = delete;
+        engine &operator=(const engine &) = delete;
+
+        bool jit_enabled() const
+        {
+            return code != nullptr;
+        }
+
+        size_t translated_blocks() const
+        {
+            return translated;
+        }
+
+        // Drops all translated code, e.g. after the text segment changed
+        void flush()
+        {
+            entries.clear();
+            pending.clear();
+            translated = 0;
+            used = code_start;
+        }
+
+        // Runs from pc until s.budget is used up, an instruction blocks cannot run (ecall, unknown
+        // encodings, ld/sd, missing words) is next, or an access faults (s.fault is set and the
+        // faulting instruction did not run). Returns the pc of the next instruction.
+        uint32_t run(state &s, uint32_t pc)
+        {
+            interp_machine m;
+            m.regs = s.regs;
+            m.s = &s;
+            s.fault = 0;
+
+            while (s.budget > 0)
+            {
+                entry &e = lookup(pc);
+                if (e.b.ops.empty())
+                    return pc;
+
+                if (e.b.count > s.budget)
+                {
+                    // the tail of the budget runs one instruction at a time
+                    blocks::block single = blocks::build(pc, text, 1);
+                    if (!interpret(m, single, pc))
+                        return pc;
+                    continue;
+                }
+
+#ifdef JIT_X86_64
+                if (!e.code && code && ++e.hits >= HOT_THRESHOLD)
+                    translate(e);
+                if (e.code)
+                {
+                    pc = reinterpret_cast<uint32_t (*)(state *, uint8_t *)>(code)(&s, e.code);
+                    if (s.fault)
+                        return pc;
+                    continue;
+                }
+#endif
+                if (!interpret(m, e.b, pc))
+                    return pc;
+            }
+            return pc;
+        }
+
+    private:
+        struct entry
+        {
+            blocks::block b;
+            uint32_t hits = 0;
+            uint8_t *code = nullptr;
+        };
+
+        static const size_t CODE_SIZE = 16 << 20;
+
+        const PagedMemory &text;
+        unordered_map<uint32_t, entry> entries;          // node based, entry references stay valid
+        unordered_multimap<uint32_t, uint8_t *> pending; // jumps waiting for their target's translation
+        uint8_t *code = nullptr;                         // trampoline followed by translated blocks
+        size_t code_start = 0, used = 0;
+        size_t translated = 0;
+
+        entry &lookup(uint32_t pc)
+        {
+            auto it = entries.find(pc);
+            if (it == entries.end())
+            {
+                it = entries.emplace(pc, entry()).first;
+                it->second.b = blocks::build(pc, text);
+            }
+            return it->second;
+        }
+
+        bool interpret(interp_machine &m, const blocks::block &b, uint32_t &pc)
+        {
+            try
+            {
+                pc = blocks::execute(m, b);
+                return true;
+            }
+            catch (const fault_error &)
+            {
+                pc = m.at->pc;
+                return false;
+            }
+        }
+
+#ifdef JIT_X86_64
+        // x86-64 code generation. Translated code runs with rbx = &state; it returns the next
+        // pc in eax to the trampoline, or jumps straight into the next translated block.
+        enum Reg : uint8_t
+        {
+            EAX = 0,
+            ECX = 1,
+            EDX = 2
+        };
+
+        void byte(uint8_t b)
+        {
+            code[used++] = b;
+        }
+
+        void word(uint32_t v)
+        {
+            memcpy(code + used, &v, 4);
+            used += 4;
+        }
+
+        void quad(uint64_t v)
+        {
+            memcpy(code + used, &v, 8);
+            used += 8;
+        }
+
+        static uint32_t reg_offset(uint8_t r)
+        {
+            return offsetof(state, regs) + 4 * r;
+        }
+
+        // mov reg, [rbx + offset]
+        void load_field(Reg reg, uint32_t offset)
+        {
+            byte(0x8B);
+            byte(0x83 | reg << 3);
+            word(offset);
+        }
+
+        void load_reg(Reg reg, uint8_t r)
+        {
+            load_field(reg, reg_offset(r));
+        }
+
+        // mov [rbx + regs[rd]], eax
+        void store_eax(uint8_t rd)
+        {
+            if (rd == 0)
+                return;
+            byte(0x89);
+            byte(0x83);
+            word(reg_offset(rd));
+        }
+
+        // mov dword [rbx + regs[rd]], value
+        void store_const(uint8_t rd, uint32_t value)
+        {
+            if (rd == 0)
+                return;
+            byte(0xC7);
+            byte(0x83);
+            word(reg_offset(rd));
+            word(value);
+        }
+
+        // add reg, value
+        void add_const(Reg reg, uint32_t value)
+        {
+            if (value == 0)
+                return;
+            byte(0x81);
+            byte(0xC0 | reg);
+            word(value);
+        }
+
+        // op qword [rbx + budget], value with op the /digit of the 0x81 group
+        void budget_op(uint8_t digit, uint32_t value)
+        {
+            byte(0x48);
+            byte(0x81);
+            byte(0x83 | digit << 3);
+            word(offsetof(state, budget));
+            word(value);
+        }
+
+        // mov eax, pc; ret
+        void return_pc(uint32_t pc)
+        {
+            byte(0xB8);
+            word(pc);
+            byte(0xC3);
+        }
+
+        // Leaves the block for a known pc: a jmp that initially goes to the return right after
+        // it and is patched to the target's code once that is translated. 11 bytes.
+        void exit_to(uint32_t target)
+        {
+            uint8_t *site = code + used;
+            byte(0xE9);
+            word(0);
+            return_pc(target);
+            auto it = entries.find(target);
+            if (it != entries.end() && it->second.code)
+                patch(site, it->second.code);
+            else
+            {
+                patch(site, site + 5);
+                pending.emplace(target, site);
+            }
+        }
+
+        static void patch(uint8_t *site, uint8_t *target)
+        {
+            int32_t rel = static_cast<int32_t>(target - (site + 5));
+            memcpy(site + 1, &rel, 4);
+        }
+
+        // Calls s.load / s.store with rdi = &state, esi = funct3, edx = address (and ecx = value),
+        // then leaves the block with pc if the access faulted, refunding the unexecuted budget.
+        void call_memory(uint32_t field, uint32_t funct3, uint32_t pc, uint32_t remaining)
+        {
+            byte(0x48), byte(0x89), byte(0xDF); // mov rdi, rbx
+            byte(0xBE), word(funct3);           // mov esi, funct3
+            byte(0x48);                         // mov rax, [rbx + field]
+            load_field(EAX, field);
+            byte(0xFF), byte(0xD0);             // call rax
+
+            byte(0x83), byte(0xBB), word(offsetof(state, fault)), byte(0); // cmp dword [rbx + fault], 0
+            byte(0x74), byte(17);                                         // je over the exit
+            budget_op(0, remaining);                                      // add [budget], remaining
+            return_pc(pc);
+        }
+
+        void emit_trampoline()
+        {
+            // uint32_t enter(state *s, uint8_t *block)
+            byte(0x53);                         // push rbx
+            byte(0x55);                         // push rbp, keeps rsp 16 byte aligned in the blocks
+            byte(0x48), byte(0x89), byte(0xFB); // mov rbx, rdi
+            byte(0xFF), byte(0xD6);             // call rsi
+            byte(0x5D);                         // pop rbp
+            byte(0x5B);                         // pop rbx
+            byte(0xC3);                         // ret
+            code_start = used = 16;
+        }
+
+        void alu(isa::Op op)
+        {
+            switch (op)
+            {
+            case isa::Op::Add:
+                byte(0x01), byte(0xC8); // add eax, ecx
+                break;
+            case isa::Op::Sub:
+                byte(0x29), byte(0xC8);
+                break;
+            case isa::Op::And:
+                byte(0x21), byte(0xC8);
+                break;
+            case isa::Op::Or:
+                byte(0x09), byte(0xC8);
+                break;
+            case isa::Op::Xor:
+                byte(0x31), byte(0xC8);
+                break;
+            case isa::Op::Sll:
+                byte(0xD3), byte(0xE0); // shl eax, cl (the count is masked to 5 bits like RISC-V)
+                break;
+            case isa::Op::Srl:
+                byte(0xD3), byte(0xE8);
+                break;
+            case isa::Op::Sra:
+                byte(0xD3), byte(0xF8);
+                break;
+            case isa::Op::Slt:
+                byte(0x39), byte(0xC8);             // cmp eax, ecx
+                byte(0x0F), byte(0x9C), byte(0xC0); // setl al
+                byte(0x0F), byte(0xB6), byte(0xC0); // movzx eax, al
+                break;
+            case isa::Op::Mul:
+                byte(0x0F), byte(0xAF), byte(0xC1); // imul eax, ecx
+                break;
+            default:
+                byte(0x89), byte(0xC6);                      // mov esi, eax
+                byte(0x89), byte(0xCA);                      // mov edx, ecx
+                byte(0xBF), word(static_cast<uint32_t>(op)); // mov edi, op
+                byte(0x48), byte(0xB8);                      // mov rax, divide
+                quad(reinterpret_cast<uint64_t>(&divide));
+                byte(0xFF), byte(0xD0);                      // call rax
+                break;
+            }
+        }
+
+        // cmp regs[rs1], regs[rs2] then jcc to the taken exit, which follows the fallthrough exit
+        void branch(blocks::UOp kind, uint8_t rs1, uint8_t rs2, uint32_t taken, uint32_t not_taken)
+        {
+            static const uint8_t conditions[] = {0x84, 0x85, 0x8C, 0x8D}; // je, jne, jl, jge
+            int index = (static_cast<int>(kind) - static_cast<int>(kind >= blocks::UOp::AddiBeq ? blocks::UOp::AddiBeq : blocks::UOp::Beq));
+            load_reg(EAX, rs1);
+            byte(0x3B), byte(0x83), word(reg_offset(rs2)); // cmp eax, [rbx + regs[rs2]]
+            byte(0x0F), byte(conditions[index]), word(11);
+            exit_to(not_taken);
+            exit_to(taken);
+        }
+
+        void translate(entry &e)
+        {
+            const blocks::block &b = e.b;
+            if (CODE_SIZE - used < 128 * b.ops.size() + 64)
+                flush_code();
+
+            uint8_t *start = code + used;
+
+            // enough budget for the whole block? otherwise hand it back to the dispatcher
+            budget_op(7, b.count); // cmp [budget], count
+            byte(0x73), byte(6);   // jae over the return
+            return_pc(b.entry);
+            budget_op(5, b.count); // sub [budget], count
+
+            uint32_t done = 0; // instructions before the current micro-op
+            bool ended = false;
+            for (const blocks::micro_op &u : b.ops)
+            {
+                switch (u.kind)
+                {
+                case blocks::UOp::Alu:
+                    load_reg(EAX, u.rs1);
+                    load_reg(ECX, u.rs2);
+                    alu(u.op);
+                    store_eax(u.rd);
+                    break;
+                case blocks::UOp::AluImm:
+                    load_reg(EAX, u.rs1);
+                    byte(0xB9), word(u.imm); // mov ecx, imm
+                    alu(u.op);
+                    store_eax(u.rd);
+                    break;
+                case blocks::UOp::Load:
+                    load_reg(EDX, u.rs1);
+                    add_const(EDX, u.imm);
+                    call_memory(offsetof(state, load), u.funct3, u.pc, b.count - done);
+                    store_eax(u.rd);
+                    break;
+                case blocks::UOp::Store:
+                    load_reg(EDX, u.rs1);
+                    add_const(EDX, u.imm);
+                    load_reg(ECX, u.rs2);
+                    call_memory(offsetof(state, store), u.funct3, u.pc, b.count - done);
+                    break;
+                case blocks::UOp::Beq:
+                case blocks::UOp::Bne:
+                case blocks::UOp::Blt:
+                case blocks::UOp::Bge:
+                    branch(u.kind, u.rs1, u.rs2, u.pc + u.imm, u.pc + 4);
+                    ended = true;
+                    break;
+                case blocks::UOp::Lui:
+                    store_const(u.rd, u.imm);
+                    break;
+                case blocks::UOp::Auipc:
+                    store_const(u.rd, u.pc + u.imm);
+                    break;
+                case blocks::UOp::Jal:
+                    store_const(u.rd, u.pc + 4);
+                    exit_to(u.pc + u.imm);
+                    ended = true;
+                    break;
+                case blocks::UOp::Jalr:
+                    load_reg(EAX, u.rs1);
+                    add_const(EAX, u.imm);
+                    store_const(u.rd, u.pc + 4);
+                    byte(0xC3); // ret with the target in eax
+                    ended = true;
+                    break;
+                case blocks::UOp::LuiAddi:
+                    store_const(u.rd, u.imm);
+                    load_reg(EAX, u.rs1b);
+                    add_const(EAX, u.imm2);
+                    store_eax(u.rd2);
+                    break;
+                case blocks::UOp::AuipcJalr:
+                    store_const(u.rd, u.pc + u.imm);
+                    load_reg(EAX, u.rs1b);
+                    add_const(EAX, u.imm2);
+                    store_const(u.rd2, u.pc + 8);
+                    byte(0xC3);
+                    ended = true;
+                    break;
+                case blocks::UOp::AddiBeq:
+                case blocks::UOp::AddiBne:
+                case blocks::UOp::AddiBlt:
+                case blocks::UOp::AddiBge:
+                    load_reg(EAX, u.rs1);
+                    add_const(EAX, u.imm);
+                    store_eax(u.rd);
+                    branch(u.kind, u.rs1b, u.rs2b, u.pc + 4 + u.imm2, u.pc + 8);
+                    ended = true;
+                    break;
+                }
+                done += u.count;
+            }
+            if (!ended)
+                exit_to(b.entry + 4 * b.count);
+
+            e.code = start;
+            translated++;
+
+            // chain the jumps that were waiting for this block
+            auto range = pending.equal_range(b.entry);
+            for (auto it = range.first; it != range.second; ++it)
+                patch(it->second, start);
+            pending.erase(b.entry);
+        }
+
+        // Out of code space: forget every translation, the profile starts over
+        void flush_code()
+        {
+            for (auto &item : entries)
+            {
+                item.second.code = nullptr;
+                item.second.hits = 0;
+            }
+            pending.clear();
+            translated = 0;
+            used = code_start;
+        }
+#endif
+    };
+}
@@ -0,0 +1,251 @@
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Sparse byte addressed guest memory. The 32 bit address space is split into 4 KiB pages that
+// are allocated on the first write, so reads never allocate. Each page also keeps a bitmap of
+// the bytes that were written: the simulators treat a never written byte differently from a
+// zero byte (end of the text segment, memory dumps, loads of partially written words).
+// Writes also mark 64 byte lines dirty so memory views can redraw only what changed.
+// Copies are cheap: they share tables and pages, and whichever side writes first to a shared
+// table or page gets its own copy of it. The dirty bits are view bookkeeping rather than
+// contents and are cleared in place, shared or not.
+struct PagedMemory
+{
+    static const uint32_t PAGE_BITS = 12;
+    static const uint32_t PAGE_SIZE = 1u << PAGE_BITS;
+    static const uint32_t PAGE_MASK = PAGE_SIZE - 1;
+    static const uint32_t LINE_BITS = 6; // dirty tracking granule, one bit per line in Page::dirty
+
+    struct Page
+    {
+        uint8_t bytes[PAGE_SIZE];
+        uint8_t written[PAGE_SIZE / 8];
+        uint64_t dirty;
+    };
+
+    PagedMemory() {}
+
+    PagedMemory(const PagedMemory &other)
+    {
+        *this = other;
+    }
+
+    PagedMemory &operator=(const PagedMemory &other)
+    {
+        for (uint32_t t = 0; t < TABLES; t++)
+            tables[t] = other.tables[t];
+        all_dirty = other.all_dirty;
+        return *this;
+    }
+
+    void clear()
+    {
+        for (uint32_t t = 0; t < TABLES; t++)
+            tables[t].reset();
+    }
+
+    // Makes the next take_dirty report its whole window, for when the contents were replaced
+    void mark_all_dirty()
+    {
+        all_dirty = true;
+    }
+
+    const Page *find_page(uint32_t addr) const
+    {
+        const Table *table = tables[addr >> 22].get();
+        return table ? table->pages[(addr >> PAGE_BITS) & (PAGES_PER_TABLE - 1)].get() : nullptr;
+    }
+
+    Page *find_page(uint32_t addr)
+    {
+        return const_cast<Page *>(static_cast<const PagedMemory *>(this)->find_page(addr));
+    }
+
+    bool written(uint32_t addr) const
+    {
+        const Page *page = find_page(addr);
+        uint32_t off = addr & PAGE_MASK;
+        return page && (page->written[off >> 3] >> (off & 7) & 1);
+    }
+
+    // value of a byte, 0 when it was never written
+    uint8_t read8(uint32_t addr) const
+    {
+        const Page *page = find_page(addr);
+        return page ? page->bytes[addr & PAGE_MASK] : 0;
+    }
+
+    void write8(uint32_t addr, uint8_t value)
+    {
+        Page &page = touch(addr);
+        uint32_t off = addr & PAGE_MASK;
+        page.bytes[off] = value;
+        page.written[off >> 3] |= 1 << (off & 7);
+        page.dirty |= 1ull << (off >> LINE_BITS);
+    }
+
+    // Reads size (1, 2 or 4) bytes big-endian into value. Unwritten bytes are skipped rather than
+    // read as zero, matching the string memory that concatenated whatever bytes existed.
+    // Returns how many of the bytes were written.
+    int read(uint32_t addr, int size, uint32_t &value) const
+    {
+        const Page *page = find_page(addr);
+        uint32_t off = addr & PAGE_MASK;
+        if (page && (off & (size - 1)) == 0)
+        {
+            uint32_t mask = (1u << size) - 1;
+            if ((page->written[off >> 3] >> (off & 7) & mask) == mask)
+            {
+                const uint8_t *b = page->bytes + off;
+                if (size == 4)
+                    value = (uint32_t(b[0]) << 24) | (uint32_t(b[1]) << 16) | (uint32_t(b[2]) << 8) | b[3];
+                else if (size == 2)
+                    value = (uint32_t(b[0]) << 8) | b[1];
+                else
+                    value = b[0];
+                return size;
+            }
+        }
+
+        int count = 0;
+        value = 0;
+        for (int i = 0; i < size; i++)
+        {
+            if (written(addr + i))
+            {
+                value = (value << 8) | read8(addr + i);
+                count++;
+            }
+        }
+        return count;
+    }
+
+    // Writes the low size (1, 2 or 4) bytes of value big-endian
+    void write(uint32_t addr, uint32_t value, int size)
+    {
+        uint32_t off = addr & PAGE_MASK;
+        if ((off & (size - 1)) == 0)
+        {
+            Page &page = touch(addr);
+            for (int i = size - 1; i >= 0; i--, value >>= 8)
+                page.bytes[off + i] = value & 0xFF;
+            page.written[off >> 3] |= ((1u << size) - 1) << (off & 7);
+            page.dirty |= 1ull << (off >> LINE_BITS);
+            return;
+        }
+
+        for (int i = size - 1; i >= 0; i--, value >>= 8)
+            write8(addr + i, value & 0xFF);
+    }
+
+    // Stores consecutive bytes given as pairs of hex digits starting at addr
+    void write_hex(uint32_t addr, const string &hex)
+    {
+        for (size_t i = 0; i < hex.size(); i += 2, addr++)
+            write8(addr, stoul(hex.substr(i, 2), nullptr, 16));
+    }
+
+    // Two uppercase hex digits for every written byte in [addr, addr + count)
+    string hex(uint32_t addr, int count) const
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        string s;
+        for (int i = 0; i < count; i++)
+        {
+            if (!written(addr + i))
+                continue;
+            uint8_t b = read8(addr + i);
+            s += digits[b >> 4];
+            s += digits[b & 15];
+        }
+        return s;
+    }
+
+    // (start, size) of the parts of [addr, addr + count) in lines written since they were last
+    // taken, merged and clipped to the window, in increasing order. The lines reported become clean.
+    // After mark_all_dirty it is the whole window, once.
+    vector<pair<uint32_t, uint32_t>> take_dirty(uint32_t addr, uint32_t count)
+    {
+        vector<pair<uint32_t, uint32_t>> ranges;
+        uint64_t end = min<uint64_t>(uint64_t(addr) + count, 1ull << 32);
+        uint64_t line = addr >> LINE_BITS << LINE_BITS;
+        while (line < end)
+        {
+            Page *page = find_page(static_cast<uint32_t>(line));
+            uint64_t page_end = (line | PAGE_MASK) + 1;
+            if (!page || !page->dirty)
+            {
+                line = page_end;
+                continue;
+            }
+            for (; line < page_end && line < end; line += 1u << LINE_BITS)
+            {
+                uint64_t bit = 1ull << ((line & PAGE_MASK) >> LINE_BITS);
+                if (!(page->dirty & bit))
+                    continue;
+                page->dirty &= ~bit;
+                uint64_t first = max<uint64_t>(line, addr);
+                uint32_t size = static_cast<uint32_t>(min<uint64_t>(line + (1u << LINE_BITS), end) - first);
+                if (!ranges.empty() && uint64_t(ranges.back().first) + ranges.back().second == first)
+                    ranges.back().second += size;
+                else
+                    ranges.push_back({static_cast<uint32_t>(first), size});
+            }
+        }
+        if (all_dirty)
+        {
+            ranges.clear();
+            if (end > addr)
+                ranges.push_back({addr, static_cast<uint32_t>(end - addr)});
+            all_dirty = false;
+        }
+        return ranges;
+    }
+
+    // Base addresses of the allocated pages, in increasing order
+    vector<uint32_t> pages() const
+    {
+        vector<uint32_t> bases;
+        for (uint32_t t = 0; t < TABLES; t++)
+        {
+            if (!tables[t])
+                continue;
+            for (uint32_t p = 0; p < PAGES_PER_TABLE; p++)
+                if (tables[t]->pages[p])
+                    bases.push_back((t << 22) | (p << PAGE_BITS));
+        }
+        return bases;
+    }
+
+private:
+    static const uint32_t TABLES = 1024;
+    static const uint32_t PAGES_PER_TABLE = 1024;
+
+    struct Table
+    {
+        shared_ptr<Page> pages[PAGES_PER_TABLE];
+    };
+
+    shared_ptr<Table> tables[TABLES];
+    bool all_dirty = false;
+
+    Page &touch(uint32_t addr)
+    {
+        shared_ptr<Table> &table = tables[addr >> 22];
+        if (!table)
+            table = make_shared<Table>();
+        else if (table.use_count() > 1)
+            table = make_shared<Table>(*table); // shares the pages, only the table is copied
+        shared_ptr<Page> &page = table->pages[(addr >> PAGE_BITS) & (PAGES_PER_TABLE - 1)];
+        if (!page)
+            page = make_shared<Page>(); // value-initialised: zero bytes, nothing written
+        else if (page.use_count() > 1)
+            page = make_shared<Page>(*page);
+        return *page;
+    }
+};
@@ -4,39 +4,26 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <unordered_map>
+#include <cstdint>
+#include <cstring>
 #include <stdexcept>
 #include <algorithm>
 #include <cmath>
 #include <bitset>
+#include <chrono>
 #include <emscripten/bind.h>
 #include "assembler.cpp"
+#include "paged_memory.cpp"
+#include "isa.cpp"
+#include "block_cache.cpp"
+#include "console_ring.cpp"
+#include "watchpoints.cpp"
+#include "branch_predictors.cpp"
 using ll = long long int;
 using ld = long double;
 using namespace std;
 
-// global controls
-bool forwarding_enable = false, piplining_enable = true;
-string printPipelineForInstruction = "";
-vector<pair<string, string>> forwardingPaths;
-vector<vector<string>> hazards;
-
-// global variables which are used to simulate global registers
-ll clock_cycle = 0;
-ll instructionCt = 0;
-ld CPI = 0;
-ll DataTransferInstr = 0;
-ll ALUInstr = 0;
-ll ControlInstr = 0;
-ll stalls = 0;
-ll data_hazards = 0;
-ll control_hazards = 0;
-ll mispredictions = 0;
-ll data_stalls = 0;
-ll control_stalls = 0;
-
-string rz, ry, ra, rb;
-string consoleOutput = "";
-
 // Forward declarations of classes
 struct RegisterFile;
 struct ALU;
@@ -47,28 +34,305 @@ class functions;
 class control_circuitry;
 struct buffers;
 struct BranchPredictor;
+namespace fast
+{
+    class engine;
+    class engine_state;
+}
+
+// How much the engines write to the console while they run. Full is the cycle by cycle trace,
+// Hazards keeps the hazard, forwarding and flush messages, Summary only prints one line when the
+// program finishes, and Off prints nothing. The spotlight (printPipelineForInstruction) is
+// shown at every level except Off; errors are always reported.
+enum class TraceLevel
+{
+    Off,
+    Summary,
+    Hazards,
+    Full
+};
+
+// What getPipelineState shows after one cycle, packed into 60 bytes so a long history fits in a
+// few MB. Latch fields are kept as numbers; the IF stage word is read back from the text segment,
+// which does not change while a program runs. Forwarding paths and hazards are coded from the
+// strings the engines produce: a cycle has at most two hazards, since a control hazard flushes
+// what decode would have checked.
+struct HistoryEntry
+{
+    enum : uint8_t
+    {
+        IFID_BUBBLE = 1,
+        IDEX_BUBBLE = 2,
+        EXMEM_BUBBLE = 4,
+        MEMWB_BUBBLE = 8,
+        OUT_SET = 16, // exmem_out holds a value
+        RY_SET = 32
+    };
+
+    // how a hazard word is printed
+    enum : uint8_t
+    {
+        WORD_HEX,    // eight uppercase digits
+        WORD_EMPTY,  // "", the instruction of a bubble
+        WORD_NO_PC   // "ffffffff"
+    };
+
+    uint32_t pc; // next fetch address
+    uint32_t ifid_pc, ifid_instr;
+    uint32_t idex_instr, idex_imm;
+    uint32_t exmem_instr, exmem_out;
+    uint32_t memwb_instr, ry;
+    uint32_t hazard_words[2][2];
+    uint16_t idex_regs; // rs1 | rs2 << 5 | rd << 10
+    uint8_t exmem_type; // isa::Op
+    uint8_t memwb_rd;
+    uint8_t flags;
+    uint8_t paths;        // count in bits 0-2, then a bit per path: 0 EX/MEM-ID/EX, 1 MEM/WB-ID/EX
+    uint8_t hazards;      // count in bits 0-1, then two bits per hazard: 0 Control, 1 EX/MEM data, 2 MEM/WB data
+    uint8_t hazard_forms; // two bits per hazard word, WORD_*
+};
+static_assert(sizeof(HistoryEntry) == 60, "history entries should stay small");
+
+// The last `capacity` cycles as HistoryEntry, indexed by cycle count. Off (capacity 0) unless
+// the simulator turns it on. Engines call record() at the end of every cycle.
+class CycleHistory
+{
+public:
+    void set_capacity(uint32_t cycles)
+    {
+        capacity = cycles;
+        entries.assign(cycles, HistoryEntry());
+        first = next = 0;
+    }
+
+    uint32_t size_limit() const
+    {
+        return capacity;
+    }
+
+    void clear()
+    {
+        first = next = 0;
+    }
+
+    // The entry to fill for the state after `cycle`, or null while the history is off. A cycle
+    // that does not follow the last one recorded starts the history afresh.
+    HistoryEntry *record(uint64_t cycle)
+    {
+        if (!capacity)
+            return nullptr;
+        if (cycle != next || first == next)
+            first = next = cycle;
+        next++;
+        if (next - first > capacity)
+            first = next - capacity;
+        return &entries[cycle % capacity];
+    }
+
+    // Keeps the cycles up to and including cycle, for replaying the ones after it
+    void rewind(uint64_t cycle)
+    {
+        if (cycle >= first && cycle < next)
+            next = cycle + 1;
+        else
+            first = next = 0;
+    }
+
+    const HistoryEntry *at(uint64_t cycle) const
+    {
+        return cycle >= first && cycle < next ? &entries[cycle % capacity] : nullptr;
+    }
+
+    bool empty() const
+    {
+        return first == next;
+    }
+
+    uint64_t oldest() const
+    {
+        return first;
+    }
+
+    uint64_t newest() const
+    {
+        return next - 1;
+    }
+
+    // Codes the forwarding paths and hazards of the cycle into entry
+    static void encode_links(HistoryEntry &entry, const vector<pair<string, string>> &paths, const vector<vector<string>> &hazards)
+    {
+        entry.paths = 0;
+        for (size_t i = 0; i < paths.size() && i < 4; i++)
+            entry.paths = (entry.paths + 1) | (paths[i].first == "MEM/WB" ? 8 << i : 0);
+
+        entry.hazards = 0;
+        entry.hazard_forms = 0;
+        for (size_t i = 0; i < hazards.size() && i < 2; i++)
+        {
+            const vector<string> &h = hazards[i];
+            bool control = h[0] == "Control";
+            int kind = control ? 0 : h[3] == "EX/MEM" ? 1 : 2;
+            const string &a = control ? h[1] : h[2];
+            const string &b = control ? h[2] : h[4];
+            entry.hazards = (entry.hazards + 1) | kind << (2 + 2 * i);
+            entry.hazard_words[i][0] = word(a);
+            entry.hazard_words[i][1] = word(b);
+            entry.hazard_forms |= (form(a) | form(b) << 2) << (4 * i);
+        }
+    }
+
+private:
+    uint32_t capacity = 0;
+    vector<HistoryEntry> entries;
+    uint64_t first = 0, next = 0; // cycles held, [first, next)
+
+    static uint8_t form(const string &s)
+    {
+        return s.empty() ? HistoryEntry::WORD_EMPTY : s == "ffffffff" ? HistoryEntry::WORD_NO_PC : HistoryEntry::WORD_HEX;
+    }
+
+    static uint32_t word(const string &s)
+    {
+        return s.empty() ? 0 : static_cast<uint32_t>(stoul(s, nullptr, 16));
+    }
+};
+
+// Full-state checkpoints of the fast engine, taken at the start of every interval-th cycle, for
+// seeking by restoring the nearest earlier one and replaying. When more than `limit` are held
+// every other one is dropped and the interval doubles, so a long run keeps a bounded number
+// spread over all of it; the one at the first cycle is always kept.
+struct CheckpointLog
+{
+    uint32_t interval = 1000; // 0 turns checkpoints off
+    uint32_t limit = 64;
+    uint64_t next_due = 0; // cycle of the next checkpoint, UINT64_MAX when off
+    map<uint64_t, shared_ptr<fast::engine_state>> saved;
+
+    // Forgets everything; the next cycle run starts a new log
+    void reset(uint64_t cycle)
+    {
+        saved.clear();
+        next_due = interval ? cycle : UINT64_MAX;
+    }
+
+    void add(uint64_t cycle, shared_ptr<fast::engine_state> state)
+    {
+        saved[cycle] = move(state);
+        if (saved.size() > limit)
+        {
+            interval *= 2;
+            uint64_t base = saved.begin()->first;
+            for (auto it = next(saved.begin()); it != saved.end();)
+                it = (it->first - base) % interval ? saved.erase(it) : next(it);
+        }
+        schedule(cycle);
+    }
+
+    // Sets next_due to the first checkpoint cycle after cycle that is not held yet
+    void schedule(uint64_t cycle)
+    {
+        if (!interval || saved.empty())
+        {
+            next_due = interval ? cycle : UINT64_MAX;
+            return;
+        }
+        uint64_t base = saved.begin()->first;
+        next_due = base + ((cycle - base) / interval + 1) * interval;
+        while (saved.count(next_due))
+            next_due += interval;
+    }
+
+    // Checkpoints after cycle belong to a timeline that changed
+    void drop_after(uint64_t cycle)
+    {
+        saved.erase(saved.upper_bound(cycle), saved.end());
+        schedule(cycle);
+    }
+};
+
+// Everything a simulation used to keep in process-wide globals. Each RiscVPipelinedSimulator
+// owns one and points ctx at it for the duration of every API call (see context_scope), so
+// independent simulators can coexist in one module and run on separate threads.
+struct SimContext
+{
+    // global controls
+    bool forwarding_enable = false, piplining_enable = true;
+    string printPipelineForInstruction = "";
+    TraceLevel trace = TraceLevel::Full;
+    Watchpoints watch; // kept across init so breakpoints survive a reset
+    CycleHistory history; // its capacity is kept across init, the cycles are not
+    CheckpointLog checkpoints;
+    vector<pair<string, string>> forwardingPaths;
+    vector<vector<string>> hazards;
+
+    // statistics
+    ll clock_cycle = 0;
+    ll instructionCt = 0;
+    ld CPI = 0;
+    ll DataTransferInstr = 0;
+    ll ALUInstr = 0;
+    ll ControlInstr = 0;
+    ll stalls = 0;
+    ll data_hazards = 0;
+    ll control_hazards = 0;
+    ll mispredictions = 0;
+    ll data_stalls = 0;
+    ll control_stalls = 0;
+
+    // datapath registers of the string engine
+    string rz, ry, ra, rb;
+
+    // the same for the integer engine; the _set flags are false while the string engine would still hold ""
+    struct
+    {
+        uint32_t rz = 0, ry = 0, ra = 0, rb = 0;
+        bool rz_set = false, ry_set = false;
+    } dp;
+
+    ConsoleRing console;
+};
+
+thread_local SimContext *ctx = nullptr; // context of the simulator whose API call is running on this thread
+
+// Makes a simulator's context current for one API call
+struct context_scope
+{
+    SimContext *saved;
 
-// Global instances that will be accessed by exported functions
-PMI_data *g_data_memory = nullptr;
-PMI_text *g_text_memory = nullptr;
-IAG *g_iag = nullptr;
-RegisterFile *g_registers = nullptr;
-ALU *g_alu = nullptr;
-buffers *g_buffers = nullptr;
-BranchPredictor *g_brpre = nullptr;
-control_circuitry *g_control = nullptr;
-bool g_running = true;
+    explicit context_scope(SimContext &context) : saved(ctx)
+    {
+        ctx = &context;
+    }
+
+    ~context_scope()
+    {
+        ctx = saved;
+    }
+};
 
 // Helper function to append to console output
 void appendToConsole(const string &text)
 {
-    consoleOutput += text + "\n";
+    ctx->console.append(text);
+}
+
+// Hazard, forwarding and flush messages, shown at TraceLevel::Hazards and above
+void appendHazardToConsole(const string &text)
+{
+    if (ctx->trace == TraceLevel::Full || ctx->trace == TraceLevel::Hazards)
+        appendToConsole(text);
+}
+
+// The only line TraceLevel::Summary prints, once the exit ecall has gone through the pipeline
+void trace_summary()
+{
+    appendToConsole("Program finished after " + to_string(ctx->clock_cycle) + " cycles, " + to_string(ctx->instructionCt) + " instructions");
 }
 
 // Clear console output
 void clearConsole()
 {
-    consoleOutput = "";
+    ctx->console.clear();
 }
 
 // hexadecimal to integer
@@ -217,7 +481,7 @@ struct IFID_buffer
     }
     void flush()
     {
-        stalls++;
+        ctx->stalls++;
         pc = "ffffffff";
         next_pc = "ffffffff";
         instr = "";
@@ -251,7 +515,7 @@ struct IDEX_buffer
     }
     void flush()
     {
-        stalls++;
+        ctx->stalls++;
         pc = "ffffffff";
         next_pc = "ffffffff";
         instr = "";
@@ -299,7 +563,7 @@ struct EXMEM_buffer
     }
     void flush()
     {
-        stalls++;
+        ctx->stalls++;
         pc = "ffffffff";
         next_pc = "ffffffff";
         instr = "";
@@ -325,7 +589,7 @@ struct MEMWB_buffer
     bool wb_needed;
     MEMWB_buffer()
     {
-        stalls++;
+        ctx->stalls++;
         pc = "ffffffff";
         next_pc = "ffffffff";
         instr = "";
@@ -432,8 +696,8 @@ struct ALU
 
     void perform_op()
     {
-        int aVal = hex_to_dec_signed(ra);
-        int bVal = hex_to_dec_signed(rb);
+        int aVal = hex_to_dec_signed(ctx->ra);
+        int bVal = hex_to_dec_signed(ctx->rb);
         // appendToConsole("ra: " + ra + " rb: " + rb);
         // appendToConsole("aVal: " + to_string(aVal) + " bVal: " + to_string(bVal));
 
@@ -473,7 +737,7 @@ struct ALU
             result = (aVal >= bVal) ? 1 : 0;
         else if (operation == "lui" || operation == "jal")
         {
-            ALUInstr--;
+            ctx->ALUInstr--;
             result = bVal;
         }
         else
@@ -483,9 +747,9 @@ struct ALU
         }
 
         if (operation == "")
-            rz = "";
+            ctx->rz = "";
         else
-            rz = dec_to_hex_32bit(result);
+            ctx->rz = dec_to_hex_32bit(result);
         // appendToConsole("result in rz: " + rz);
     }
 };
@@ -493,28 +757,50 @@ struct ALU
 // Memory Structure
 struct Memory
 {
-    map<int, string> memory;
+    PagedMemory memory;
+
+    string getRow(int addr)
+    {
+        string addrHex = "0x" + dec_to_hex_32bit(addr);
+
+        string value = "";
+        if (memory.written(addr))
+        {
+            value = memory.hex(addr, 4);
+        }
+        else
+        {
+            value = "00";
+        }
+
+        return addrHex + ":" + value + ";";
+    }
 
     string getMemoryContent(int startAddr, int count)
     {
+        memory.take_dirty(startAddr, count + 3); // the window is up to date now
         string result = "";
         for (int i = 0; i < count; i++)
         {
-            int addr = startAddr + i;
-            string addrHex = "0x" + dec_to_hex_32bit(addr);
-
-            string value = "";
-            if (memory.find(addr) != memory.end())
-            {
-                value = memory[addr] + memory[addr + 1] +
-                        memory[addr + 2] + memory[addr + 3];
-            }
-            else
-            {
-                value = "00";
-            }
+            result += getRow(startAddr + i);
+        }
+        return result;
+    }
 
-            result += addrHex + ":" + value + ";";
+    // The rows of the window whose bytes were written since it was last shown
+    string getChangedContent(int startAddr, int count)
+    {
+        string result = "";
+        int64_t start = static_cast<uint32_t>(startAddr), end = start + count;
+        int64_t next = start; // rows before this one are done
+        for (const auto &range : memory.take_dirty(startAddr, count + 3))
+        {
+            // a row shows the 4 bytes from its address, so the 3 rows before a change see it too
+            int64_t first = max(max<int64_t>(range.first - 3ll, next), start);
+            int64_t last = min<int64_t>(range.first + int64_t(range.second), end);
+            for (int64_t addr = first; addr < last; addr++)
+                result += getRow(static_cast<int>(addr));
+            next = max(next, last);
         }
         return result;
     }
@@ -526,6 +812,7 @@ struct PMI_text
     string MAR; // Memory Address Register
     string MDR; // Memory Data Register
     Memory mem;
+    unsigned version = 0; // bumped on every store so decoded copies of the text can be invalidated
 
     PMI_text() : mem() {}
 
@@ -536,10 +823,8 @@ struct PMI_text
 
         if (address < 268435456)
         {
-            mem.memory[address] = MDR.substr(0, 2);
-            mem.memory[address + 1] = MDR.substr(2, 2);
-            mem.memory[address + 2] = MDR.substr(4, 2);
-            mem.memory[address + 3] = MDR.substr(6, 2); // Storing word as instruction is always 32 bits
+            version++;
+            mem.memory.write_hex(address, MDR.substr(0, 8)); // Storing word as instruction is always 32 bits
             // appendToConsole("Stored instruction: " + MDR + " at " + MAR);
         }
         else
@@ -555,11 +840,7 @@ struct PMI_text
 
         if (address < 268435456)
         {
-            MDR = "";
-            MDR += mem.memory[address];
-            MDR += mem.memory[address + 1];
-            MDR += mem.memory[address + 2];
-            MDR += mem.memory[address + 3];
+            MDR = mem.memory.hex(address, 4);
 
             // appendToConsole("Loaded instruction: " + MDR + " from " + MAR);
         }
@@ -574,6 +855,11 @@ struct PMI_text
     {
         return mem.getMemoryContent(startAddr, count);
     }
+
+    string getChangedContent(int startAddr, int count)
+    {
+        return mem.getChangedContent(startAddr, count);
+    }
 };
 
 // PMI (Processor Memory Interface)
@@ -585,47 +871,43 @@ struct PMI_data
 
     PMI_data() : mem() {}
 
-    // Load from mem into MDR
-    void load(string type)
+    // Bytes accessed for a funct3 type, after checking the access is allowed
+    int access_size(int address, uint32_t type)
     {
-        int address = hex_to_dec(MAR);
-
         if (address < 268435456)
         {
             appendToConsole("This is data memory only and cannot access the text segment.");
             throw runtime_error("This is data memory only and cannot access the text segment.\\n");
         }
-        else
+        if (type == 3)
         {
-            if (type == "011")
-            {
-                appendToConsole("Loading double is not possible in a 32 bit register.");
-                throw runtime_error("Loading double is not possible in a 32 bit register.\\n");
-            } // double
-            else if (type == "000")
-            {
-                MDR = mem.memory[address];
-            } // Loading byte
-            else if (type == "001")
-            {
-                MDR = "";
-                MDR += mem.memory[address];
-                MDR += mem.memory[address + 1];
-            } // Loading half word
-            else
-            {
-                MDR = "";
-                MDR += mem.memory[address];
-                MDR += mem.memory[address + 1];
-                MDR += mem.memory[address + 2];
-                MDR += mem.memory[address + 3];
-            } // Loading word by default
+            appendToConsole("Loading double is not possible in a 32 bit register.");
+            throw runtime_error("Loading double is not possible in a 32 bit register.\\n");
+        } // double
+        if (type == 0)
+            return 1; // byte
+        if (type == 1)
+            return 2; // half word
+        return 4;     // word by default
+    }
 
-            if (MDR == "")
-                MDR = "00000000"; // If no data at this address, return 0
-        }
-        while (MDR.size() < 8)
-            MDR = "0" + MDR;
+    // Load without going through MAR/MDR; bytes never written read as nothing, 0 if none was
+    uint32_t load(int address, uint32_t type)
+    {
+        uint32_t value = 0;
+        mem.memory.read(address, access_size(address, type), value);
+        return value;
+    }
+
+    void store(int address, uint32_t value, uint32_t type)
+    {
+        mem.memory.write(address, value, access_size(address, type));
+    }
+
+    // Load from mem into MDR
+    void load(string type)
+    {
+        MDR = dec_to_hex_32bit(load(hex_to_dec(MAR), stoi(type, nullptr, 2)));
         //appendToConsole("loaded data: " + MDR + " from " + MAR);
     }
 
@@ -633,34 +915,8 @@ struct PMI_data
     void store(string type)
     {
         int address = hex_to_dec(MAR);
-
-        if (address < 268435456)
-        {
-            appendToConsole("This is data memory only and cannot access the text segment.");
-            throw runtime_error("This is data memory only and cannot access the text segment.\\n");
-        }
-        else
-        {
-            if (type == "011")
-            {
-                appendToConsole("Loading double is not possible in a 32 bit register.");
-                throw runtime_error("Loading double is not possible in a 32 bit register.\\n");
-            } // double
-            else if (type == "000")
-                mem.memory[address] = MDR.substr(6, 2); // Storing byte
-            else if (type == "001")
-            {
-                mem.memory[address] = MDR.substr(4, 2);
-                mem.memory[address + 1] = MDR.substr(6, 2); // Storing half word
-            }
-            else
-            {
-                mem.memory[address] = MDR.substr(0, 2);
-                mem.memory[address + 1] = MDR.substr(2, 2);
-                mem.memory[address + 2] = MDR.substr(4, 2);
-                mem.memory[address + 3] = MDR.substr(6, 2); // Storing word by default
-            }
-        }
+        int size = access_size(address, stoi(type, nullptr, 2));
+        mem.memory.write_hex(address, MDR.substr(8 - 2 * size, 2 * size));
         // appendToConsole("stored data: " + MDR + " at " + MAR);
     }
 
@@ -668,6 +924,11 @@ struct PMI_data
     {
         return mem.getMemoryContent(startAddr, count);
     }
+
+    string getChangedContent(int startAddr, int count)
+    {
+        return mem.getChangedContent(startAddr, count);
+    }
 };
 
 struct RegisterFile
@@ -698,14 +959,14 @@ struct RegisterFile
     void readRS()
     {
         if (rs1 != DONT_CARE)
-            ra = regs[rs1];
+            ctx->ra = regs[rs1];
         if (rs2 != DONT_CARE)
-            rb = regs[rs2];
+            ctx->rb = regs[rs2];
     }
 
     void writeRD()
     {
-        string value = ry;
+        string value = ctx->ry;
         if (rd != DONT_CARE && rd != 0)
             regs[rd] = value;
     }
@@ -942,15 +1203,15 @@ private:
         // data hazard
         if (buf.exmem.rd != "00000" && (buf.idex.rs1 == buf.exmem.rd || buf.idex.rs2 == buf.exmem.rd))
         {
-            data_hazards++;
-            appendToConsole(" ");
-            appendToConsole("!!EXECUTE STAGE DATA HAZARD DETECTED!!");
-            hazards.push_back({"Data", "ID/EX", buf.idex.instr, "EX/MEM", buf.exmem.instr});
-            if (!forwarding_enable)
+            ctx->data_hazards++;
+            appendHazardToConsole(" ");
+            appendHazardToConsole("!!EXECUTE STAGE DATA HAZARD DETECTED!!");
+            ctx->hazards.push_back({"Data", "ID/EX", buf.idex.instr, "EX/MEM", buf.exmem.instr});
+            if (!ctx->forwarding_enable)
             {
-                data_stalls++;
-                appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
-                appendToConsole(" ");
+                ctx->data_stalls++;
+                appendHazardToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                appendHazardToConsole(" ");
                 iag.pc = buf.ifid.pc;
                 buf.idex.flush();
                 stall = true;
@@ -959,9 +1220,9 @@ private:
             {
                 if (buf.exmem.opcode == "0000011") // the instruction in execute is a memory load type
                 {
-                    data_stalls++;
-                    appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
-                    appendToConsole(" ");
+                    ctx->data_stalls++;
+                    appendHazardToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                    appendHazardToConsole(" ");
                     // stall is needed as the value will be avaliable in next cycle only and cant forward in future
                     iag.pc = buf.ifid.pc;
                     buf.idex.flush();
@@ -969,21 +1230,21 @@ private:
                 }
                 else // do forwarding
                 {
-                    appendToConsole("DATA FORWARDING");
-                    appendToConsole("From Instruction " + buf.exmem.instr + ": EXECUTE Stage");
-                    appendToConsole("To Instruction " + buf.idex.instr + ": DECODE Stage");
-                    appendToConsole(" ");
+                    appendHazardToConsole("DATA FORWARDING");
+                    appendHazardToConsole("From Instruction " + buf.exmem.instr + ": EXECUTE Stage");
+                    appendHazardToConsole("To Instruction " + buf.idex.instr + ": DECODE Stage");
+                    appendHazardToConsole(" ");
                     if (buf.idex.rs1 == buf.exmem.rd) // rs1 is dependent on the value in exmem stage
                     {
                         buf.idex.rs1val = buf.exmem.exe_out;
-                        ra = buf.idex.rs1val;
-                        forwardingPaths.push_back({"EX/MEM", "ID/EX"});
+                        ctx->ra = buf.idex.rs1val;
+                        ctx->forwardingPaths.push_back({"EX/MEM", "ID/EX"});
                     }
                     if (buf.idex.rs2 == buf.exmem.rd) // rs2 is dependent on the value in exmem stage
                     {
                         buf.idex.rs2val = buf.exmem.exe_out;
-                        rb = buf.idex.rs2val;
-                        forwardingPaths.push_back({"EX/MEM", "ID/EX"});
+                        ctx->rb = buf.idex.rs2val;
+                        ctx->forwardingPaths.push_back({"EX/MEM", "ID/EX"});
                     }
                 }
             }
@@ -991,22 +1252,22 @@ private:
 
         if (buf.memwb.rd != "00000" && (buf.idex.rs1 == buf.memwb.rd || buf.idex.rs2 == buf.memwb.rd))
         {
-            data_hazards++;
-            appendToConsole(" ");
-            appendToConsole("!!MEMORY STAGE DATA HAZARD DETECTED!!");
-            hazards.push_back({"Data", "ID/EX", buf.idex.instr, "MEM/WB", buf.memwb.instr});
-            if (!forwarding_enable)
+            ctx->data_hazards++;
+            appendHazardToConsole(" ");
+            appendHazardToConsole("!!MEMORY STAGE DATA HAZARD DETECTED!!");
+            ctx->hazards.push_back({"Data", "ID/EX", buf.idex.instr, "MEM/WB", buf.memwb.instr});
+            if (!ctx->forwarding_enable)
             {
-                data_stalls++;
+                ctx->data_stalls++;
                 if (!stall)
                 {
-                    appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
-                    appendToConsole(" ");
+                    appendHazardToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                    appendHazardToConsole(" ");
                 }
                 else
                 {
-                    appendToConsole("!!STALLED ALREADY!!");
-                    appendToConsole(" ");
+                    appendHazardToConsole("!!STALLED ALREADY!!");
+                    appendHazardToConsole(" ");
                 }
                 iag.pc = buf.ifid.pc;
                 buf.idex.flush();
@@ -1014,21 +1275,21 @@ private:
             }
             else
             {
-                appendToConsole("DATA FORWARDING");
-                appendToConsole("From Instruction " + buf.memwb.instr + ": MEMORY Stage");
-                appendToConsole("To Instruction " + buf.idex.instr + ": DECODE Stage");
-                appendToConsole(" ");
+                appendHazardToConsole("DATA FORWARDING");
+                appendHazardToConsole("From Instruction " + buf.memwb.instr + ": MEMORY Stage");
+                appendHazardToConsole("To Instruction " + buf.idex.instr + ": DECODE Stage");
+                appendHazardToConsole(" ");
                 if (buf.idex.rs1 == buf.memwb.rd)
                 {
-                    buf.idex.rs1val = ry;
-                    ra = buf.idex.rs1val;
-                    forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                    buf.idex.rs1val = ctx->ry;
+                    ctx->ra = buf.idex.rs1val;
+                    ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
                 }
                 if (buf.idex.rs2 == buf.memwb.rd)
                 {
-                    buf.idex.rs2val = ry;
-                    rb = buf.idex.rs2val;
-                    forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                    buf.idex.rs2val = ctx->ry;
+                    ctx->rb = buf.idex.rs2val;
+                    ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
                 }
             }
         }
@@ -1157,8 +1418,8 @@ public:
 
             registers.setAddresses(stoi(buf.idex.rs1, nullptr, 2), stoi(buf.idex.rs2, nullptr, 2));
             registers.readRS();
-            buf.idex.rs1val = ra;
-            buf.idex.rs2val = rb;
+            buf.idex.rs1val = ctx->ra;
+            buf.idex.rs2val = ctx->rb;
 
             hazard_detection();
 
@@ -1170,15 +1431,15 @@ public:
     {
         if (buf.idex.opcode != "0110011" && buf.idex.opcode != "1100011") // if instruction is I or load or store or jalr or auipc
         {
-            rb = buf.idex.imm;
+            ctx->rb = buf.idex.imm;
         }
 
         if (buf.idex.opcode == "0010111")
-            ra = buf.idex.pc; // auipc
+            ctx->ra = buf.idex.pc; // auipc
 
         if (buf.idex.pc != "ffffffff" && buf.idex.instr != "00000073")
         {
-            ALUInstr++;
+            ctx->ALUInstr++;
             alu.perform_op();
         }
 
@@ -1195,7 +1456,7 @@ public:
         buf.exmem.instr_type = buf.idex.instr_type;
         buf.exmem.rs1val = buf.idex.rs1val;
         buf.exmem.rs2val = buf.idex.rs2val;
-        buf.exmem.exe_out = rz;
+        buf.exmem.exe_out = ctx->rz;
         buf.exmem.mem_store_needed = buf.idex.mem_store_needed;
         buf.exmem.mem_load_needed = buf.idex.mem_load_needed;
         buf.exmem.wb_needed = buf.idex.wb_needed;
@@ -1203,20 +1464,20 @@ public:
         string ret_addr;
         if (buf.idex.branch_needed) // branch
         {
-            ControlInstr++;
+            ctx->ControlInstr++;
             if (buf.exmem.exe_out == "00000001")
             {
                 ret_addr = dec_to_hex_32bit(hex_to_dec(buf.idex.pc) + hex_to_dec_signed(buf.idex.imm));
                 if (buf.ifid.pc != ret_addr)
                 {
-                    control_stalls += 2;
-                    control_hazards++;
-                    mispredictions++;
-                    appendToConsole(" ");
-                    appendToConsole("!!CONTROL HAZARD DETECTED!!");
-                    appendToConsole("FLUSHING THE PIPELINE...");
-                    appendToConsole(" ");
-                    hazards.push_back({"Control", buf.ifid.pc, ret_addr});
+                    ctx->control_stalls += 2;
+                    ctx->control_hazards++;
+                    ctx->mispredictions++;
+                    appendHazardToConsole(" ");
+                    appendHazardToConsole("!!CONTROL HAZARD DETECTED!!");
+                    appendHazardToConsole("FLUSHING THE PIPELINE...");
+                    appendHazardToConsole(" ");
+                    ctx->hazards.push_back({"Control", buf.ifid.pc, ret_addr});
                     iag.update(ret_addr, true);
                     buf.ifid.flush();
                     buf.idex.flush();
@@ -1229,14 +1490,14 @@ public:
                 ret_addr = buf.exmem.next_pc;
                 if (buf.ifid.pc != ret_addr)
                 {
-                    control_stalls += 2;
-                    control_hazards++;
-                    mispredictions++;
-                    appendToConsole(" ");
-                    appendToConsole("!!CONTROL HAZARD DETECTED!!");
-                    appendToConsole("FLUSHING THE PIPELINE...");
-                    appendToConsole(" ");
-                    hazards.push_back({"Control", buf.ifid.pc, ret_addr});
+                    ctx->control_stalls += 2;
+                    ctx->control_hazards++;
+                    ctx->mispredictions++;
+                    appendHazardToConsole(" ");
+                    appendHazardToConsole("!!CONTROL HAZARD DETECTED!!");
+                    appendHazardToConsole("FLUSHING THE PIPELINE...");
+                    appendHazardToConsole(" ");
+                    ctx->hazards.push_back({"Control", buf.ifid.pc, ret_addr});
                     iag.update(ret_addr, true);
                     buf.ifid.flush();
                     buf.idex.flush();
@@ -1247,18 +1508,18 @@ public:
 
         else if (buf.idex.jal) // jal
         {
-            ControlInstr++;
+            ctx->ControlInstr++;
             ret_addr = dec_to_hex_32bit(hex_to_dec(buf.idex.pc) + hex_to_dec_signed(buf.idex.imm));
             if (buf.ifid.pc != ret_addr)
             {
-                control_stalls += 2;
-                control_hazards++;
-                mispredictions++;
-                appendToConsole(" ");
-                appendToConsole("!!CONTROL HAZARD DETECTED!!");
-                appendToConsole("FLUSHING THE PIPELINE...");
-                appendToConsole(" ");
-                hazards.push_back({"Control", buf.ifid.pc, ret_addr});
+                ctx->control_stalls += 2;
+                ctx->control_hazards++;
+                ctx->mispredictions++;
+                appendHazardToConsole(" ");
+                appendHazardToConsole("!!CONTROL HAZARD DETECTED!!");
+                appendHazardToConsole("FLUSHING THE PIPELINE...");
+                appendHazardToConsole(" ");
+                ctx->hazards.push_back({"Control", buf.ifid.pc, ret_addr});
                 iag.update(ret_addr, true);
                 buf.ifid.flush();
                 buf.idex.flush();
@@ -1268,18 +1529,18 @@ public:
 
         else if (buf.idex.jalr) // jalr
         {
-            ControlInstr++;
+            ctx->ControlInstr++;
             ret_addr = buf.exmem.exe_out;
             if (buf.ifid.pc != ret_addr)
             {
-                control_stalls += 2;
-                control_hazards++;
-                mispredictions++;
-                appendToConsole(" ");
-                appendToConsole("!!CONTROL HAZARD DETECTED!!");
-                appendToConsole("FLUSHING THE PIPELINE...");
-                appendToConsole(" ");
-                hazards.push_back({"Control", buf.ifid.pc, ret_addr});
+                ctx->control_stalls += 2;
+                ctx->control_hazards++;
+                ctx->mispredictions++;
+                appendHazardToConsole(" ");
+                appendHazardToConsole("!!CONTROL HAZARD DETECTED!!");
+                appendHazardToConsole("FLUSHING THE PIPELINE...");
+                appendHazardToConsole(" ");
+                ctx->hazards.push_back({"Control", buf.ifid.pc, ret_addr});
                 iag.update(ret_addr, true);
                 buf.ifid.flush();
                 buf.idex.flush();
@@ -1289,8 +1550,8 @@ public:
 
         if (buf.exmem.opcode == "1101111" || buf.exmem.opcode == "1100111")
         {
-            rz = buf.exmem.next_pc;
-            buf.exmem.exe_out = rz;
+            ctx->rz = buf.exmem.next_pc;
+            buf.exmem.exe_out = ctx->rz;
         }
     }
 
@@ -1301,7 +1562,12 @@ public:
             data_memory.MAR = address;
             data_memory.MDR = data;
             data_memory.store(type);
-            DataTransferInstr++;
+            ctx->DataTransferInstr++;
+            if (ctx->watch.armed)
+            {
+                int funct3 = stoi(type, nullptr, 2);
+                ctx->watch.stored(hex_to_dec(address), funct3 == 0 ? 1 : funct3 == 1 ? 2 : 4);
+            }
         }
         buf.memwb.pc = buf.exmem.pc;
         buf.memwb.next_pc = buf.exmem.next_pc;
@@ -1325,8 +1591,8 @@ public:
         {
             data_memory.MAR = address;
             data_memory.load(type);
-            ry = data_memory.MDR;
-            DataTransferInstr++;
+            ctx->ry = data_memory.MDR;
+            ctx->DataTransferInstr++;
         }
         buf.memwb.pc = buf.exmem.pc;
         buf.memwb.next_pc = buf.exmem.next_pc;
@@ -1346,7 +1612,7 @@ public:
     }
     void accessMemory()
     {
-        ry = rz;
+        ctx->ry = ctx->rz;
         buf.memwb.pc = buf.exmem.pc;
         buf.memwb.next_pc = buf.exmem.next_pc;
         buf.memwb.instr = buf.exmem.instr;
@@ -1370,12 +1636,14 @@ public:
         {
             registers.rd = stoi(buf.memwb.rd, nullptr, 2);
             registers.writeRD();
+            if (ctx->watch.armed && registers.rd != 0)
+                ctx->watch.wrote_register(registers.rd, hex_to_dec(registers.regs[registers.rd]));
         }
         if (buf.memwb.instr == "00000073")
         {
             flag = false;
         }
-        instructionCt++;
+        ctx->instructionCt++;
     }
 };
 
@@ -1397,75 +1665,83 @@ public:
 
     void step_cycle(bool &flag)
     {
-        forwardingPaths.clear();
-        hazards.clear();
-        appendToConsole("Cycle " + to_string(clock_cycle + 1) + ":");
+        ctx->forwardingPaths.clear();
+        ctx->hazards.clear();
+        bool full = ctx->trace == TraceLevel::Full;
+        bool shown = ctx->trace != TraceLevel::Off; // the spotlight is hidden only when tracing is off
+        if (full)
+            appendToConsole("Cycle " + to_string(ctx->clock_cycle + 1) + ":");
 
         if (f.buf.memwb.wb_needed)
         {
             f.writeBack(flag);
-            appendToConsole(
-                "  W: PC="+ f.buf.memwb.pc + " rd=x" +to_string(f.registers.rd) +
-                " val=" + ry);
+            if (full)
+                appendToConsole(
+                    "  W: PC="+ f.buf.memwb.pc + " rd=x" +to_string(f.registers.rd) +
+                    " val=" + ctx->ry);
 
-            if (f.buf.memwb.pc == printPipelineForInstruction)
+            if (shown && f.buf.memwb.pc == ctx->printPipelineForInstruction)
             {
                 appendToConsole(" ");
-                appendToConsole("Instruction at PC " + printPipelineForInstruction + " completes Writeback.");
+                appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Writeback.");
                 appendToConsole("Contents of RegisterFile: ");
                 for (int i = 0; i < 32; i++)
                 {
-                    string result = "x" + to_string(i) + ":" + g_registers->regs[i] + ";";
+                    string result = "x" + to_string(i) + ":" + f.registers.regs[i] + ";";
                     appendToConsole(result);
                 }
                 appendToConsole(" ");
             }
         }
-        else
+        else if (full)
         {
             appendToConsole("  W: PC=" + f.buf.memwb.pc );
         }
 
         if (f.buf.exmem.mem_load_needed)
         {
-            f.accessMemory(rz, f.buf.exmem.funct3);
-            appendToConsole(
-                "  M: PC="+ f.buf.memwb.pc  +" LOAD type=" +f.buf.exmem.funct3 +
-                " data=" + ry +
-                " addr=" + rz);
+            f.accessMemory(ctx->rz, f.buf.exmem.funct3);
+            if (full)
+                appendToConsole(
+                    "  M: PC="+ f.buf.memwb.pc  +" LOAD type=" +f.buf.exmem.funct3 +
+                    " data=" + ctx->ry +
+                    " addr=" + ctx->rz);
         }
         else if (f.buf.exmem.mem_store_needed)
         {
-            f.accessMemory(rz, f.buf.exmem.rs2val, f.buf.exmem.funct3);
-            appendToConsole(
-                "  M: PC=" + f.buf.memwb.pc +" STORE type=" + f.buf.exmem.funct3 +
-                " data=" + f.buf.exmem.rs2val +
-                " addr=" + rz);
+            f.accessMemory(ctx->rz, f.buf.exmem.rs2val, f.buf.exmem.funct3);
+            if (full)
+                appendToConsole(
+                    "  M: PC=" + f.buf.memwb.pc +" STORE type=" + f.buf.exmem.funct3 +
+                    " data=" + f.buf.exmem.rs2val +
+                    " addr=" + ctx->rz);
         }
         else
         {
             f.accessMemory();
-            appendToConsole("  M: PC="+ f.buf.memwb.pc );
+            if (full)
+                appendToConsole("  M: PC="+ f.buf.memwb.pc );
         }
 
-        if (f.buf.exmem.pc == printPipelineForInstruction)
+        if (shown && f.buf.exmem.pc == ctx->printPipelineForInstruction)
         {
             appendToConsole(" ");
-            appendToConsole("Instruction at PC " + printPipelineForInstruction + " completes Memory stage.");
+            appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Memory stage.");
             appendToConsole("Contents of Exe/Mem buffer: PC=" + f.buf.exmem.pc + ", Instr=" + f.buf.exmem.instr +
                             ", ALU Result=" + f.buf.exmem.exe_out + ", rs2val=" + f.buf.exmem.rs2val);
             appendToConsole(" ");
         }
 
         f.execute();
-        appendToConsole(
-            "  E: PC="+ f.buf.exmem.pc +" op="+ f.alu.operation +
-            " result=" + rz);
+        if (full)
+            appendToConsole(
+                "  E: PC="+ f.buf.exmem.pc +" op="+ f.alu.operation +
+                " result=" + ctx->rz);
 
-        if (f.buf.idex.pc == printPipelineForInstruction)
+        if (shown && f.buf.idex.pc == ctx->printPipelineForInstruction)
         {
             appendToConsole(" ");
-            appendToConsole("Instruction at PC " + printPipelineForInstruction + " completes Execute stage.");
+            appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Execute stage.");
             appendToConsole("Contents of Dec/Exe buffer: PC=" + f.buf.idex.pc + ", Instr=" + f.buf.idex.instr +
                             ", rs1val=" + f.buf.idex.rs1val + ", rs2val=" + f.buf.idex.rs2val +
                             ", Imm=" + f.buf.idex.imm + ", ALU Operation=" + f.alu.operation);
@@ -1473,45 +1749,57 @@ public:
         }
 
         f.decode();
-        appendToConsole(
-            "  D: PC=" + f.buf.idex.pc +" opcode=" + f.buf.idex.opcode +
-            " rd=" + f.buf.idex.rd +
-            " rs1=" + f.buf.idex.rs1 +
-            " rs2=" + f.buf.idex.rs2 +
-            " type=" + f.buf.idex.instr_type);
+        if (full)
+            appendToConsole(
+                "  D: PC=" + f.buf.idex.pc +" opcode=" + f.buf.idex.opcode +
+                " rd=" + f.buf.idex.rd +
+                " rs1=" + f.buf.idex.rs1 +
+                " rs2=" + f.buf.idex.rs2 +
+                " type=" + f.buf.idex.instr_type);
 
-        if (f.buf.ifid.pc == printPipelineForInstruction)
+        if (shown && f.buf.ifid.pc == ctx->printPipelineForInstruction)
         {
             appendToConsole(" ");
-            appendToConsole("Instruction at PC " + printPipelineForInstruction + " completes Decode stage.");
+            appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Decode stage.");
             appendToConsole("Contents of F/Dec buffer: PC=" + f.buf.ifid.pc + ", Instr=" + f.buf.ifid.instr +
                             ", Control Instruction=" + (f.buf.idex.branch_needed ? "Yes" : "No") +
-                            ", BTB Hit=" + (g_brpre->BTB.find(f.buf.ifid.pc) != g_brpre->BTB.end() ? "Yes" : "No"));
+                            ", BTB Hit=" + (f.brpre.BTB.find(f.buf.ifid.pc) != f.brpre.BTB.end() ? "Yes" : "No"));
             appendToConsole(" ");
         }
 
         f.fetch();
-        appendToConsole(
-            "  F: PC=" + f.buf.ifid.pc +
-            " Instr=" + f.buf.ifid.instr);
-        appendToConsole(" ");
+        if (ctx->watch.armed && f.buf.ifid.pc != "ffffffff")
+            ctx->watch.fetched(hex_to_dec(f.buf.ifid.pc));
+        if (full)
+        {
+            appendToConsole(
+                "  F: PC=" + f.buf.ifid.pc +
+                " Instr=" + f.buf.ifid.instr);
+            appendToConsole(" ");
+        }
 
-        if (f.buf.ifid.pc == printPipelineForInstruction)
+        if (shown && f.buf.ifid.pc == ctx->printPipelineForInstruction)
         {
             appendToConsole(" ");
-            appendToConsole("Instruction at PC " + printPipelineForInstruction + " completes Fetch stage.");
+            appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Fetch stage.");
             appendToConsole("Contents of F/Dec buffer: PC=" + f.buf.ifid.pc + ", IR=" + f.buf.ifid.instr);
             appendToConsole(" ");
         }
 
-        clock_cycle++;
+        ctx->clock_cycle++;
+        if (ctx->trace == TraceLevel::Summary && !flag)
+            trace_summary();
+        if (HistoryEntry *entry = ctx->history.record(ctx->clock_cycle))
+            record_history(*entry);
     }
 
-    void run_cycles()
+    // false once the ecall has retired
+    bool run_cycles()
     {
         bool flag = true;
-        while (flag)
+        while (flag && !ctx->watch.hit)
             step_cycle(flag);
+        return flag;
     }
 
     bool step()
@@ -1520,97 +1808,2182 @@ public:
         step_cycle(flag);
         return flag;
     }
+
+    // The pipeline state as it stands, parsed back from the strings
+    void record_history(HistoryEntry &entry)
+    {
+        auto bubble = [](const string &pc)
+        {
+            return pc.empty() || pc == "ffffffff";
+        };
+        auto bin = [](const string &bits)
+        {
+            return bits.empty() ? 0u : static_cast<uint32_t>(stoul(bits, nullptr, 2));
+        };
+        const buffers &buf = f.buf;
+        entry = HistoryEntry();
+        entry.pc = hex_to_dec(f.iag.pc);
+        entry.flags = (bubble(buf.ifid.pc) ? HistoryEntry::IFID_BUBBLE : 0) | (bubble(buf.idex.pc) ? HistoryEntry::IDEX_BUBBLE : 0) |
+                      (bubble(buf.exmem.pc) ? HistoryEntry::EXMEM_BUBBLE : 0) | (bubble(buf.memwb.pc) ? HistoryEntry::MEMWB_BUBBLE : 0) |
+                      (buf.exmem.exe_out.empty() ? 0 : HistoryEntry::OUT_SET) | (ctx->ry.empty() ? 0 : HistoryEntry::RY_SET);
+        entry.ifid_pc = hex_to_dec(buf.ifid.pc);
+        entry.ifid_instr = hex_to_dec(buf.ifid.instr);
+        entry.idex_instr = hex_to_dec(buf.idex.instr);
+        entry.idex_imm = hex_to_dec(buf.idex.imm);
+        entry.idex_regs = bin(buf.idex.rs1) | bin(buf.idex.rs2) << 5 | bin(buf.idex.rd) << 10;
+        entry.exmem_instr = hex_to_dec(buf.exmem.instr);
+        entry.exmem_out = hex_to_dec(buf.exmem.exe_out);
+        for (int op = 0; op <= static_cast<int>(isa::Op::Unknown); op++)
+            if (buf.exmem.instr_type == isa::op_name(static_cast<isa::Op>(op)))
+                entry.exmem_type = op;
+        entry.memwb_instr = hex_to_dec(buf.memwb.instr);
+        entry.memwb_rd = bin(buf.memwb.rd);
+        entry.ry = hex_to_dec(ctx->ry);
+        CycleHistory::encode_links(entry, ctx->forwardingPaths, ctx->hazards);
+    }
 };
 
-// Class to expose to JavaScript
-class RiscVPipelinedSimulator
+// Limits of a bounded run; a run always stops at the ecall as well
+struct RunLimits
 {
-public:
-    RiscVPipelinedSimulator() : initialized(false) {}
+    uint64_t cycles = UINT64_MAX;
+    bool has_stop_pc = false;
+    uint32_t stop_pc = 0; // stop once the instruction at this pc has been fetched
+    double millis = 0;    // host time budget, 0 for none
+};
 
-    string assemble(const string &code)
+enum class RunStatus
+{
+    Halted,
+    CycleLimit,
+    ReachedPC,
+    TimeLimit,
+    Watch // a breakpoint or watchpoint was hit
+};
+
+// Steps until the program ends, a limit is reached or a watch is hit, counting the cycles run. step_cycle runs
+// one cycle and returns false at the ecall, fetched_pc gives the pc in the F/D latch. The host
+// clock is only read every 256 cycles.
+template <class Step, class Fetched>
+RunStatus run_bounded(const RunLimits &limits, uint64_t &cycles, Step step_cycle, Fetched fetched_pc)
+{
+    auto start = chrono::steady_clock::now();
+    for (cycles = 0; cycles < limits.cycles;)
     {
-        return ::assemble(code);
+        bool more = step_cycle();
+        cycles++;
+        if (!more)
+            return RunStatus::Halted;
+        if (limits.has_stop_pc && fetched_pc() == limits.stop_pc)
+            return RunStatus::ReachedPC;
+        if (ctx->watch.hit)
+            return RunStatus::Watch;
+        if (limits.millis > 0 && (cycles & 255) == 0 &&
+            chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() >= limits.millis)
+            return RunStatus::TimeLimit;
     }
+    return RunStatus::CycleLimit;
+}
 
-    void init()
+// Fixed layout snapshot of the simulator for readers that should not parse strings. The UI maps
+// it as a Uint32Array through getStateView(), a native harness reads the struct directly. Every
+// field is a 32 bit word; bump STATE_LAYOUT when the layout changes.
+const uint32_t STATE_LAYOUT = 1;
+
+// bits of LatchState::flags
+const uint32_t LATCH_OPERANDS = 1; // rs1val and rs2val hold values
+const uint32_t LATCH_EXE_OUT = 2;  // exe_out holds a value
+const uint32_t LATCH_MEM_STORE = 4;
+const uint32_t LATCH_MEM_LOAD = 8;
+const uint32_t LATCH_WB = 16;
+const uint32_t LATCH_BRANCH = 32;
+const uint32_t LATCH_JAL = 64;
+const uint32_t LATCH_JALR = 128;
+
+// A bubble has pc and next_pc 0xffffffff and every other field 0. F/D only fills pc, next_pc
+// and instr.
+struct LatchState
+{
+    uint32_t pc, next_pc, instr, imm, rs1val, rs2val, exe_out;
+    uint32_t opcode, rd, rs1, rs2, funct3, funct7;
+    uint32_t instr_type; // isa::Op
+    uint32_t flags;
+};
+
+struct PredictorEntry
+{
+    uint32_t pc, target, taken;
+};
+
+struct StateBlock
+{
+    uint32_t layout;
+    uint32_t generation; // changes whenever the simulator state may have changed
+    uint32_t pc;         // next fetch address
+    uint32_t running;
+    uint32_t regs[32];
+    LatchState ifid, idex, exmem, memwb;
+    uint32_t ry, ry_set; // value written back this cycle
+
+    // statistics, low 32 bits
+    uint32_t cycles, instructions, data_transfer, alu, control, stalls;
+    uint32_t data_hazards, control_hazards, mispredictions, data_stalls, control_stalls;
+
+    uint32_t predictor_entries; // entries in the predictor view, ordered by pc
+};
+static_assert(sizeof(StateBlock) % 4 == 0 && is_trivially_copyable<StateBlock>::value, "state block must be plain 32 bit words");
+
+// bits of StepDelta::latches
+const uint32_t DELTA_IFID = 1;
+const uint32_t DELTA_IDEX = 2;
+const uint32_t DELTA_EXMEM = 4;
+const uint32_t DELTA_MEMWB = 8;
+
+// What one cycle changed, recorded by the fast engine while it steps (see stepWithDelta)
+struct StepDelta
+{
+    struct Store
     {
-        if (initialized)
-        {
-            cleanup();
-        }
-        clearConsole();
+        uint32_t address, size, value;
+    };
 
-        g_data_memory = new PMI_data();
-        g_text_memory = new PMI_text();
-        g_iag = new IAG();
-        g_registers = new RegisterFile();
-        g_alu = new ALU();
-        g_buffers = new buffers();
-        g_brpre = new BranchPredictor();
-        g_control = new control_circuitry(*g_data_memory, *g_text_memory, *g_iag, *g_registers, *g_alu, *g_buffers, *g_brpre);
-        g_running = true;
-        clock_cycle = 0;
-        instructionCt = 0;
-        CPI = 0;
-        DataTransferInstr = 0;
-        ALUInstr = 0;
-        ControlInstr = 0;
-        stalls = 0;
-        data_hazards = 0;
-        control_hazards = 0;
-        mispredictions = 0;
-        data_stalls = 0;
-        control_stalls = 0;
-        initialized = true;
-        forwardingPaths.clear();
-        hazards.clear();
-        printPipelineForInstruction = "";
-        appendToConsole("=> Simulator initialized");
+    bool more = true;     // false when the cycle retired the ecall, like step()
+    uint32_t pc = 0;      // next fetch address
+    uint32_t latches = 0; // DELTA_* bits of the latches whose StateBlock view changed
+    vector<pair<uint32_t, uint32_t>> registers; // register, value written
+    vector<Store> stores;                       // data memory written
+    vector<PredictorEntry> predictor;           // entries after their update
+
+    void clear()
+    {
+        more = true;
+        pc = latches = 0;
+        registers.clear();
+        stores.clear();
+        predictor.clear();
     }
+};
 
-    void cleanup()
+// Integer-native engine. It models exactly the same datapath as functions/control_circuitry
+// above, cycle for cycle, but keeps registers, datapath registers and latch fields as
+// uint32_t/enum values. Strings are only built for the console trace and when the
+// RiscVPipelinedSimulator API asks for state (see control_circuitry::export_state).
+namespace fast
+{
+    const uint32_t NO_PC = 0xFFFFFFFF; // pc of a bubble, "ffffffff" in the string engine
+    const uint32_t ECALL = 0x00000073;
+
+    using namespace isa;
+
+    string hex32(uint32_t v)
     {
-        if (initialized)
-        {
-            delete g_data_memory;
-            delete g_text_memory;
-            delete g_iag;
-            delete g_registers;
-            delete g_alu;
-            delete g_buffers;
-            delete g_brpre;
-            delete g_control;
-
-            g_data_memory = nullptr;
-            g_text_memory = nullptr;
-            g_iag = nullptr;
-            g_registers = nullptr;
-            g_alu = nullptr;
-            g_buffers = nullptr;
-            g_brpre = nullptr;
-            g_control = nullptr;
+        static const char digits[] = "0123456789ABCDEF";
+        string s(8, '0');
+        for (int i = 7; i >= 0; i--, v >>= 4)
+            s[i] = digits[v & 15];
+        return s;
+    }
 
-            initialized = false;
-        }
+    // in-place variants used by the per-cycle trace so a cycle costs no temporaries
+    void put_hex32(string &out, uint32_t v)
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        char s[8];
+        for (int i = 7; i >= 0; i--, v >>= 4)
+            s[i] = digits[v & 15];
+        out.append(s, 8);
     }
 
-    void loadCode(const string &codeStr)
+    void put_pc(string &out, uint32_t pc)
     {
-        if (!initialized)
-        {
-            throw runtime_error("Simulator not initialized");
-        }
+        if (pc == NO_PC)
+            out += "ffffffff";
+        else
+            put_hex32(out, pc);
+    }
 
-        clearConsole();
+    void put_bits(string &out, uint32_t v, int width)
+    {
+        char s[32];
+        for (int i = width - 1; i >= 0; i--, v >>= 1)
+            s[i] = '0' + (v & 1);
+        out.append(s, width);
+    }
 
-        stringstream ss(codeStr);
-        string line;
+    string bits(uint32_t v, int width)
+    {
+        string s(width, '0');
+        for (int i = width - 1; i >= 0; i--, v >>= 1)
+            s[i] = '0' + (v & 1);
+        return s;
+    }
+
+    string pc_str(uint32_t pc)
+    {
+        return pc == NO_PC ? "ffffffff" : hex32(pc);
+    }
+
+    // bin_to_hex prints a zero immediate as "0"
+    string imm_str(uint32_t imm)
+    {
+        return imm == 0 ? "0" : hex32(imm);
+    }
+
+    uint32_t parse_hex32(const string &hex)
+    {
+        uint32_t v = 0;
+        for (char ch : hex)
+        {
+            if (ch >= '0' && ch <= '9')
+                v = (v << 4) | (ch - '0');
+            else if (ch >= 'A' && ch <= 'F')
+                v = (v << 4) | (ch - 'A' + 10);
+            else if (ch >= 'a' && ch <= 'f')
+                v = (v << 4) | (ch - 'a' + 10);
+        }
+        return v;
+    }
+
+    // Decoded form of one instruction word, with the rd/rs fields already cleared for the
+    // formats that do not use them.
+    struct decoded_instr
+    {
+        uint32_t instr = 0, imm = 0;
+        uint8_t opcode = 0, rd = 0, funct3 = 0, rs1 = 0, rs2 = 0, funct7 = 0;
+        Op instr_type = Op::None;
+        bool cached = false, mem_store_needed = false, mem_load_needed = false, wb_needed = false, branch_needed = false, jal = false, jalr = false;
+    };
+
+    decoded_instr decode_word(uint32_t instr)
+    {
+        decoded_instr d;
+        d.instr = instr;
+        d.opcode = instr & 0x7F;
+        d.rd = (instr >> 7) & 0x1F;
+        d.funct3 = (instr >> 12) & 0x7;
+        d.rs1 = (instr >> 15) & 0x1F;
+        d.rs2 = (instr >> 20) & 0x1F;
+        d.funct7 = instr >> 25;
+        d.imm = immediate(instr);
+        d.instr_type = instruction_type(instr);
+
+        if (d.opcode == OP_STORE || d.opcode == OP_BRANCH)
+            d.rd = 0; // rd is none in S and SB type instr
+        if (d.opcode == OP_LOAD || d.opcode == OP_I || d.opcode == OP_JALR)
+            d.rs2 = 0; // rs2 is none in I type instr
+        if (d.opcode == OP_JAL || d.opcode == OP_LUI)
+        {
+            d.rs1 = 0;
+            d.rs2 = 0;
+        } // rs1, rs2 is none in U type instr and UJ type
+
+        d.mem_store_needed = d.opcode == OP_STORE;
+        d.mem_load_needed = d.opcode == OP_LOAD;
+        d.wb_needed = d.opcode != OP_BRANCH && d.opcode != OP_STORE;
+        d.branch_needed = d.opcode == OP_BRANCH;
+        d.jal = d.opcode == OP_JAL;
+        d.jalr = d.opcode == OP_JALR;
+        return d;
+    }
+
+    // Text segment decoded once, indexed by (pc - base) / 4. It is rebuilt whenever PMI_text has
+    // been stored to since the last build. Words that are missing or partially written are not
+    // cached, fetch falls back to PMI_text for them so its behaviour is unchanged.
+    class decode_cache
+    {
+        vector<decoded_instr> entries;
+        uint32_t base = 0;
+        unsigned version = 0;
+        bool built = false;
+
+        void rebuild(const PagedMemory &memory)
+        {
+            entries.clear();
+            vector<uint32_t> pages = memory.pages();
+            // the text segment ends at 0x10000000, anything above is not fetchable anyway
+            while (!pages.empty() && pages.back() >= 0x10000000)
+                pages.pop_back();
+            if (pages.empty())
+                return;
+
+            base = pages.front();
+            size_t words = min(static_cast<size_t>(pages.back() - base + PagedMemory::PAGE_SIZE) / 4, MAX_WORDS);
+            entries.assign(words, decoded_instr());
+
+            for (uint32_t page : pages)
+            {
+                for (uint32_t address = page; address < page + PagedMemory::PAGE_SIZE; address += 4)
+                {
+                    size_t index = (address - base) / 4;
+                    uint32_t instr;
+                    if (index >= words)
+                        return;
+                    if (memory.read(address, 4, instr) != 4)
+                        continue;
+
+                    entries[index] = decode_word(instr);
+                    entries[index].cached = true;
+                }
+            }
+        }
+
+    public:
+        static const size_t MAX_WORDS = 1 << 20;
+
+        const decoded_instr *find(PMI_text &text, uint32_t pc)
+        {
+            if (!built || version != text.version)
+            {
+                rebuild(text.mem.memory);
+                version = text.version;
+                built = true;
+            }
+
+            uint32_t offset = pc - base;
+            if ((offset & 3) || offset / 4 >= entries.size() || !entries[offset / 4].cached)
+                return nullptr;
+            return &entries[offset / 4];
+        }
+    };
+
+    // Latches between stages, all trivially copyable: a stage hands its instruction on with one
+    // struct copy and functions keeps two banks of them, so a cycle reads the current bank, writes
+    // the next one and commits by flipping an index. pc == NO_PC marks a bubble; a flush resets
+    // the whole latch because the bubble's zero fields show up in the trace (imm, rb, rz).
+    // operands_set / exe_out_set track whether rs1val/rs2val and exe_out hold a value, they are ""
+    // in a flushed string latch.
+    struct IFID_buffer
+    {
+        uint32_t pc = NO_PC, next_pc = NO_PC, instr = 0;
+        predictors::Link link = predictors::Link::None;
+        predictors::return_stack::checkpoint ras; // before fetch pushed or popped for this instruction
+        bool redirecting = false; // a bubble while fetch waits for a predicted target
+        void flush()
+        {
+            ctx->stalls++;
+            pc = NO_PC;
+            next_pc = NO_PC;
+            instr = 0;
+            link = predictors::Link::None;
+            redirecting = false;
+        }
+    };
+    // ID/EX, EX/MEM and MEM/WB share one layout so each hand-off is a plain copy; fields a
+    // stage does not use are carried along and ignored
+    struct instr_latch
+    {
+        uint32_t pc = NO_PC, next_pc = NO_PC, instr = 0, imm = 0, rs1val = 0, rs2val = 0, exe_out = 0;
+        uint8_t opcode = 0, rd = 0, funct3 = 0, rs1 = 0, rs2 = 0, funct7 = 0;
+        Op instr_type = Op::None;
+        predictors::Link link = predictors::Link::None;
+        bool operands_set = false, exe_out_set = false, mem_store_needed = false, mem_load_needed = false, wb_needed = false, branch_needed = false, jal = false, jalr = false;
+        void flush()
+        {
+            ctx->stalls++;
+            *this = instr_latch();
+        }
+    };
+    typedef instr_latch IDEX_buffer;
+    typedef instr_latch EXMEM_buffer;
+    typedef instr_latch MEMWB_buffer;
+    struct buffers
+    {
+        IFID_buffer ifid;
+        IDEX_buffer idex;
+        EXMEM_buffer exmem;
+        MEMWB_buffer memwb;
+    };
+    static_assert(is_trivially_copyable<buffers>::value, "pipeline latches must stay plain data");
+
+    struct fetch_queue_counters
+    {
+        uint64_t cycles = 0;          // cycles fetched with the queue
+        uint64_t occupancy = 0;       // instructions left queued, summed over the cycles
+        uint64_t full = 0;            // cycles fetch stopped because the queue was full
+        uint64_t redirects = 0;       // cycles fetch waited for the target of a predicted-taken branch
+        uint64_t front_end_bound = 0; // cycles decode got a bubble while the text went on
+        uint64_t squashed = 0;        // queued instructions dropped by mispredictions
+    };
+
+    // Instruction fetch queue between IF and ID, see pipeline_config::queue_depth. Fetch appends
+    // up to fetch_width instructions a cycle along the predicted path and F/D takes the oldest
+    // one unless decode holds on to its instruction; a misprediction squashes the queue. Also
+    // keeps the rest of the front end's state, the wait for a predicted target. Plain data like
+    // the latches, so checkpoints copy it whole.
+    struct fetch_queue
+    {
+        static const unsigned MAX_DEPTH = 32;
+
+        IFID_buffer entries[MAX_DEPTH + 1]; // one more while fetch runs ahead of the hand-off
+        uint8_t head = 0, count = 0;
+        uint8_t redirect = 0; // fetch cycles left before the predicted target arrives
+        fetch_queue_counters counters;
+
+        const IFID_buffer &front() const
+        {
+            return entries[head];
+        }
+
+        void push(const IFID_buffer &entry)
+        {
+            entries[(head + count) % (MAX_DEPTH + 1)] = entry;
+            count++;
+        }
+
+        IFID_buffer pop()
+        {
+            IFID_buffer entry = entries[head];
+            head = (head + 1) % (MAX_DEPTH + 1);
+            count--;
+            return entry;
+        }
+
+        void clear()
+        {
+            head = count = redirect = 0;
+        }
+    };
+
+    struct IAG
+    {
+        uint32_t pc = 0;
+        uint32_t return_addr = 0;
+        bool use_return_addr = false;
+
+        void update(uint32_t return_addr, bool use_return_addr)
+        {
+            this->return_addr = return_addr;
+            this->use_return_addr = use_return_addr;
+        }
+
+        void compute_nextPC()
+        {
+            uint32_t next_pc_value = pc + 4;
+
+            if (use_return_addr)
+            {
+                next_pc_value = return_addr;
+                use_return_addr = false;
+                return_addr = 0;
+            }
+
+            pc = next_pc_value;
+        }
+    };
+
+    struct ALU
+    {
+        Op operation = Op::None;
+
+        void perform_op()
+        {
+            int aVal = static_cast<int32_t>(ctx->dp.ra);
+            int bVal = static_cast<int32_t>(ctx->dp.rb);
+            uint32_t result = 0;
+
+            switch (operation)
+            {
+            case Op::Add:
+            case Op::Lw:
+            case Op::Lh:
+            case Op::Lb:
+            case Op::Ld:
+            case Op::Sw:
+            case Op::Sh:
+            case Op::Sb:
+            case Op::Sd:
+            case Op::Auipc:
+            case Op::Jalr:
+                result = ctx->dp.ra + ctx->dp.rb;
+                break;
+            case Op::Sub:
+                result = ctx->dp.ra - ctx->dp.rb;
+                break;
+            case Op::And:
+                result = ctx->dp.ra & ctx->dp.rb;
+                break;
+            case Op::Or:
+                result = ctx->dp.ra | ctx->dp.rb;
+                break;
+            case Op::Xor:
+                result = ctx->dp.ra ^ ctx->dp.rb;
+                break;
+            case Op::Sll:
+                result = ctx->dp.ra << (ctx->dp.rb & 31);
+                break;
+            case Op::Srl:
+                result = ctx->dp.ra >> (ctx->dp.rb & 31);
+                break;
+            case Op::Sra:
+                result = aVal >> (bVal & 31);
+                break;
+            case Op::Slt:
+            case Op::Blt:
+                result = (aVal < bVal) ? 1 : 0;
+                break;
+            case Op::Mul:
+                result = ctx->dp.ra * ctx->dp.rb;
+                break;
+            case Op::Div: // RISC-V results, as fastForward gives, instead of trapping
+            case Op::Rem:
+                isa::compute(operation, ctx->dp.ra, ctx->dp.rb, result);
+                break;
+            case Op::Beq:
+                result = (ctx->dp.ra == ctx->dp.rb) ? 1 : 0;
+                break;
+            case Op::Bne:
+                result = (ctx->dp.ra != ctx->dp.rb) ? 1 : 0;
+                break;
+            case Op::Bge:
+                result = (aVal >= bVal) ? 1 : 0;
+                break;
+            case Op::Lui:
+            case Op::Jal:
+                ctx->ALUInstr--;
+                result = ctx->dp.rb;
+                break;
+            default:
+                appendToConsole("Invalid ALU operation: " + string(op_name(operation)));
+                throw invalid_argument("Invalid ALU operation: " + string(op_name(operation)));
+            }
+
+            ctx->dp.rz = result;
+            ctx->dp.rz_set = true;
+        }
+    };
+
+    struct RegisterFile
+    {
+        uint32_t regs[32] = {};
+        int rs1, rs2, rd;
+        int DONT_CARE = -1;
+
+        RegisterFile()
+        {
+            regs[2] = 0x7FFFFFDC;
+            rs1 = rs2 = rd = DONT_CARE;
+        }
+
+        void readRS()
+        {
+            ctx->dp.ra = regs[rs1];
+            ctx->dp.rb = regs[rs2];
+        }
+
+        void writeRD()
+        {
+            if (rd != DONT_CARE && rd != 0)
+                regs[rd] = ctx->dp.ry;
+        }
+    };
+
+    // Targets and directions of branches. By default these are the original BTB and 1 bit BHT,
+    // which the string engine runs too: every branch seen keeps its entries. Otherwise, as set
+    // by configure, the targets are in a finite target buffer and the directions come from one
+    // of the flat predictors of branch_predictors.cpp. The choice is made at run time rather
+    // than by the policy, so the engine is instantiated once for all of them. Only taken
+    // branches are entered in either target store, and a branch is predicted taken when its
+    // target is known and the direction says so.
+    struct BranchPredictor
+    {
+        map<uint32_t, uint32_t> BTB; // ordered like the string keyed BTB for getBP
+        unordered_map<uint32_t, bool> BHT;
+        bool finite = false; // targets is used instead of BTB
+        bool flat = false;   // direction is used instead of BHT
+        predictors::target_buffer targets;
+        predictors::direction_predictor direction;
+        predictors::return_stack returns; // used by fetch and execute directly, see functions
+
+        pair<bool, uint32_t> predictBranch(uint32_t pc)
+        {
+            if (pc == NO_PC)
+                return {false, 0}; // stall in the pipeline or when ecall has been encountered
+
+            const uint32_t *target = finite ? targets.lookup(pc) : nullptr;
+            bool taken;
+            if (flat)
+                taken = direction.predict(pc);
+            else
+            {
+                auto it = BHT.find(pc);
+                taken = it != BHT.end() && it->second;
+            }
+            if (taken && !finite)
+            {
+                auto btb_it = BTB.find(pc);
+                if (btb_it != BTB.end())
+                    target = &btb_it->second;
+            }
+            if (taken && target)
+                return {true, *target};
+            return {false, pc + 4};
+        }
+
+        void update(uint32_t pc, bool taken, uint32_t target)
+        {
+            if (flat)
+                direction.update(pc, taken);
+            else
+                BHT[pc] = taken;
+            if (finite)
+                targets.resolve(pc, taken, target);
+            else if (taken)
+                BTB[pc] = target;
+        }
+
+        const uint32_t *find_target(uint32_t pc) const
+        {
+            if (finite)
+                return targets.find(pc);
+            auto it = BTB.find(pc);
+            return it == BTB.end() ? nullptr : &it->second;
+        }
+
+        bool btb_hit(uint32_t pc) const
+        {
+            return find_target(pc) != nullptr;
+        }
+
+        uint32_t btb_target(uint32_t pc) const
+        {
+            const uint32_t *target = find_target(pc);
+            return target ? *target : 0;
+        }
+
+        bool predicts_taken(uint32_t pc) const
+        {
+            if (flat)
+                return direction.predict(pc);
+            auto it = BHT.find(pc);
+            return it != BHT.end() && it->second;
+        }
+
+        // f(pc, target or nullptr, taken) for every branch shown: those in the BHT, or those in
+        // the target buffer when there is no BHT
+        template <class F>
+        void for_each(F f) const
+        {
+            if (flat)
+            {
+                targets.for_each([&](uint32_t pc, const uint32_t &target)
+                                 { f(pc, &target, direction.predict(pc)); });
+                return;
+            }
+            for (const auto &entry : BHT)
+                f(entry.first, find_target(entry.first), entry.second);
+        }
+
+        // The flat predictors get a direct-mapped buffer of 2^table_bits entries unless the
+        // config sizes one; the 1 bit predictor keeps the unbounded BTB unless it does
+        void configure(const predictors::config &c)
+        {
+            clear();
+            flat = c.kind != predictors::Kind::OneBit;
+            finite = flat || c.btb.entries;
+            direction = predictors::direction_predictor();
+            targets = predictors::target_buffer();
+            if (flat)
+                direction.configure(c);
+            returns.configure(c.ras_depth);
+            if (c.btb.entries)
+                targets.configure(c.btb);
+            else if (flat)
+            {
+                predictors::btb_config own;
+                own.entries = 1u << c.table_bits;
+                targets.configure(own);
+            }
+        }
+
+        void clear()
+        {
+            BTB.clear();
+            BHT.clear();
+            targets.clear();
+            direction.clear();
+            returns.clear();
+        }
+
+        // null while the unbounded BTB is used
+        const predictors::btb_counters *btb_counters() const
+        {
+            return finite ? &targets.counters : nullptr;
+        }
+
+        // null without a return address stack
+        const predictors::ras_counters *ras_counters() const
+        {
+            return returns.enabled() ? &returns.counters : nullptr;
+        }
+    };
+
+    string instr_str(uint32_t pc, uint32_t instr)
+    {
+        return pc == NO_PC ? "" : hex32(instr);
+    }
+
+    string val_str(bool set, uint32_t val)
+    {
+        return set ? hex32(val) : "";
+    }
+
+    // the spotlight compares pc strings exactly like the string engine does
+    bool spotlight(uint32_t pc)
+    {
+        return !ctx->printPipelineForInstruction.empty() && pc_str(pc) == ctx->printPipelineForInstruction;
+    }
+
+    // Settings fixed at compile time for one instantiation of the engine, so the step loop has no
+    // runtime checks for them and the spotlight and trace code compiles out when it is off. The
+    // simulator switches instantiation when forwarding, the spotlight (printPipelineForInstruction)
+    // or the trace level changes.
+    template <bool Forwarding, bool Spotlight, TraceLevel Trace, class Predictor>
+    struct policy
+    {
+        static const bool forwarding = Forwarding;
+        static const TraceLevel trace = Trace;
+        static const bool spotlight = Spotlight && Trace != TraceLevel::Off;
+        static const bool cycle_trace = Trace == TraceLevel::Full;
+        static const bool hazard_trace = Trace == TraceLevel::Full || Trace == TraceLevel::Hazards;
+        static const bool summary_trace = Trace == TraceLevel::Summary;
+        typedef Predictor predictor;
+    };
+
+    // A checkpoint: the data segment and the statistics here, the rest of the engine in
+    // saved_state for its predictor type. The text segment never changes while a program runs.
+    class engine_state
+    {
+    public:
+        virtual ~engine_state() {}
+
+        PagedMemory data; // shares its pages with the live memory until either side writes
+
+        ll clock_cycle, instructionCt, DataTransferInstr, ALUInstr, ControlInstr, stalls;
+        ll data_hazards, control_hazards, mispredictions, data_stalls, control_stalls;
+        ld CPI;
+        decltype(SimContext::dp) dp;
+        vector<pair<string, string>> forwardingPaths;
+        vector<vector<string>> hazards;
+
+        void save_context()
+        {
+            clock_cycle = ctx->clock_cycle;
+            instructionCt = ctx->instructionCt;
+            DataTransferInstr = ctx->DataTransferInstr;
+            ALUInstr = ctx->ALUInstr;
+            ControlInstr = ctx->ControlInstr;
+            stalls = ctx->stalls;
+            data_hazards = ctx->data_hazards;
+            control_hazards = ctx->control_hazards;
+            mispredictions = ctx->mispredictions;
+            data_stalls = ctx->data_stalls;
+            control_stalls = ctx->control_stalls;
+            CPI = ctx->CPI;
+            dp = ctx->dp;
+            forwardingPaths = ctx->forwardingPaths;
+            hazards = ctx->hazards;
+        }
+
+        void restore_context() const
+        {
+            ctx->clock_cycle = clock_cycle;
+            ctx->instructionCt = instructionCt;
+            ctx->DataTransferInstr = DataTransferInstr;
+            ctx->ALUInstr = ALUInstr;
+            ctx->ControlInstr = ControlInstr;
+            ctx->stalls = stalls;
+            ctx->data_hazards = data_hazards;
+            ctx->control_hazards = control_hazards;
+            ctx->mispredictions = mispredictions;
+            ctx->data_stalls = data_stalls;
+            ctx->control_stalls = control_stalls;
+            ctx->CPI = CPI;
+            ctx->dp = dp;
+            ctx->forwardingPaths = forwardingPaths;
+            ctx->hazards = hazards;
+        }
+    };
+
+    template <class Predictor>
+    class saved_state : public engine_state
+    {
+    public:
+        IAG iag;
+        RegisterFile registers;
+        ALU alu;
+        buffers bank[2];
+        uint8_t live;
+        fetch_queue ifq;
+        Predictor brpre;
+    };
+
+    // Microarchitecture options chosen at run time, like the predictor, so they do not multiply
+    // the instantiations
+    struct pipeline_config
+    {
+        static const unsigned MAX_FETCH_WIDTH = 8;
+        static const unsigned MAX_TAKEN_PENALTY = 4;
+
+        bool branches_in_decode = false; // resolve branches and jumps in ID rather than EX
+        unsigned queue_depth = 0;        // entries of the fetch queue, 0 to fetch straight into F/D
+        unsigned fetch_width = 1;        // instructions fetched a cycle with a queue
+        unsigned taken_penalty = 0;      // fetch cycles lost redirecting to a predicted target
+    };
+
+    // What the simulator sees of an instantiation
+    class engine
+    {
+    public:
+        virtual ~engine() {}
+        virtual bool step() = 0;
+        virtual bool run_cycles() = 0;
+        virtual RunStatus run(const RunLimits &limits, uint64_t &cycles) = 0;
+        virtual uint64_t fast_forward(uint64_t count) = 0;
+        virtual void export_state(::IAG &iag, ::RegisterFile &registers, ::buffers &view, ::BranchPredictor &brpre) = 0;
+        virtual void export_block(StateBlock &block, vector<PredictorEntry> &entries) = 0;
+        virtual void step_with_delta(StepDelta &delta) = 0;
+        virtual void record_history(HistoryEntry &entry) = 0;
+        virtual shared_ptr<engine_state> save() = 0;
+        // false when the checkpoint was taken with another predictor
+        virtual bool restore(const engine_state &state) = 0;
+        // back to the state before the first cycle, keeping what was derived from the text
+        virtual void reset() = 0;
+        virtual void configure_predictor(const predictors::config &config) = 0;
+        virtual void configure_pipeline(const pipeline_config &config) = 0;
+        // null without a fetch queue or taken penalty
+        virtual const fetch_queue_counters *fetch_counters() = 0;
+        // null while the predictor has the unbounded BTB
+        virtual const predictors::btb_counters *btb_counters() = 0;
+        // null without a return address stack
+        virtual const predictors::ras_counters *ras_counters() = 0;
+        // this engine when it already matches, otherwise a new one that takes over its state
+        virtual engine *reconfigure(bool forwarding, bool spotlight, TraceLevel trace) = 0;
+    };
+
+    template <class Predictor, class... Args>
+    engine *instantiate(bool forwarding, bool spotlight, TraceLevel trace, Args &&...args);
+
+    template <class Policy>
+    class functions
+    {
+    private:
+        // Undoes the return address stack push or pop of the instruction in F/D, which is about
+        // to be squashed or fetched again
+        void repair_returns()
+        {
+            const IFID_buffer &ifid = cur().ifid;
+            if (brpre.returns.enabled() && ifid.pc != NO_PC)
+                brpre.returns.repair(ifid.ras);
+        }
+
+        // Keeps the instruction in F/D for another cycle of decode: without a fetch queue it is
+        // fetched again, with one it stays in the latch while fetch goes on filling the queue
+        void hold_decode()
+        {
+            if (config.queue_depth)
+            {
+                decode_held = true;
+                return;
+            }
+            iag.pc = cur().ifid.pc;
+            ifq.redirect = 0; // fetched again, it redirects anew
+            repair_returns();
+        }
+
+        // Drops the queued instructions, all on a mispredicted path
+        void squash_queue()
+        {
+            if (!ifq.count)
+                return;
+            if (brpre.returns.enabled())
+                brpre.returns.repair(ifq.front().ras);
+            ifq.counters.squashed += ifq.count;
+            ifq.clear();
+        }
+
+        // the pc of the instruction fetched after the one in F/D
+        uint32_t fetched_next() const
+        {
+            return ifq.count ? ifq.front().pc : iag.pc;
+        }
+
+        // the pc of the instruction fetched after the one in ID/EX, still on its way when F/D
+        // holds a redirect bubble
+        uint32_t fetched_after_decode()
+        {
+            const IFID_buffer &ifid = cur().ifid;
+            return ifid.redirecting ? fetched_next() : ifid.pc;
+        }
+
+        // A misprediction found in execute squashes the instruction in F/D and this cycle's fetch,
+        // one found in decode (pipeline_config::branches_in_decode) only this cycle's fetch
+        void control_hazard(uint32_t ret_addr, bool in_decode = false)
+        {
+            ctx->control_stalls += in_decode ? 1 : 2;
+            ctx->control_hazards++;
+            ctx->mispredictions++;
+            if (Policy::hazard_trace)
+            {
+                appendToConsole(" ");
+                appendToConsole("!!CONTROL HAZARD DETECTED!!");
+                appendToConsole("FLUSHING THE PIPELINE...");
+                appendToConsole(" ");
+            }
+            buffers &now = cur();
+            ctx->hazards.push_back({"Control", pc_str(in_decode ? fetched_next() : fetched_after_decode()), hex32(ret_addr)});
+            iag.update(ret_addr, true);
+            squash_queue();
+            ifq.redirect = 0;
+            if (in_decode)
+                return;
+            repair_returns();
+            now.ifid.flush();
+            now.idex.flush();
+        }
+
+        static bool branch_taken(Op op, uint32_t a, uint32_t b)
+        {
+            switch (op)
+            {
+            case Op::Beq:
+                return a == b;
+            case Op::Bne:
+                return a != b;
+            case Op::Blt:
+                return static_cast<int32_t>(a) < static_cast<int32_t>(b);
+            case Op::Bge:
+                return static_cast<int32_t>(a) >= static_cast<int32_t>(b);
+            default:
+                return false; // rejected by the ALU in execute
+            }
+        }
+
+        // Resolves the branch or jump just decoded into ID/EX with decode's own comparator and
+        // target adder. Its operands must be ready in decode: a result computed in EX this cycle
+        // is not, and neither is a value loaded in MEM this cycle, so those stall it; an ALU result
+        // one instruction further ahead is forwarded from MEM/WB. Without forwarding anything not
+        // yet written back stalls it.
+        void resolve_in_decode()
+        {
+            buffers &buf = nxt();
+            IDEX_buffer &idex = buf.idex;
+            bool reads_rs1 = !idex.jal, reads_rs2 = idex.branch_needed;
+            auto feeds = [&](const instr_latch &producer)
+            {
+                return producer.pc != NO_PC && producer.wb_needed && producer.rd != 0 &&
+                       ((reads_rs1 && producer.rd == idex.rs1) || (reads_rs2 && producer.rd == idex.rs2));
+            };
+            bool from_ex = feeds(buf.exmem), from_mem = !from_ex && feeds(buf.memwb);
+
+            if (from_ex || (from_mem && (!Policy::forwarding || buf.memwb.opcode == OP_LOAD)))
+            {
+                const instr_latch &producer = from_ex ? buf.exmem : buf.memwb;
+                ctx->data_hazards++;
+                ctx->data_stalls++;
+                if (Policy::hazard_trace)
+                {
+                    appendToConsole(" ");
+                    appendToConsole("!!DECODE STAGE BRANCH DATA HAZARD DETECTED!!");
+                    appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                    appendToConsole(" ");
+                }
+                ctx->hazards.push_back({"Data", "ID/EX", hex32(idex.instr), from_ex ? "EX/MEM" : "MEM/WB", hex32(producer.instr)});
+                hold_decode();
+                idex.flush();
+                return;
+            }
+            if (from_mem)
+            {
+                ctx->data_hazards++;
+                if (Policy::hazard_trace)
+                {
+                    appendToConsole(" ");
+                    appendToConsole("!!DECODE STAGE BRANCH DATA HAZARD DETECTED!!");
+                    appendToConsole("DATA FORWARDING");
+                    appendToConsole("From Instruction " + hex32(buf.memwb.instr) + ": MEMORY Stage");
+                    appendToConsole("To Instruction " + hex32(idex.instr) + ": DECODE Stage");
+                    appendToConsole(" ");
+                }
+                ctx->hazards.push_back({"Data", "ID/EX", hex32(idex.instr), "MEM/WB", hex32(buf.memwb.instr)});
+                if (reads_rs1 && buf.memwb.rd == idex.rs1)
+                {
+                    idex.rs1val = buf.memwb.exe_out;
+                    ctx->dp.ra = idex.rs1val;
+                    ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                }
+                if (reads_rs2 && buf.memwb.rd == idex.rs2)
+                {
+                    idex.rs2val = buf.memwb.exe_out;
+                    ctx->dp.rb = idex.rs2val;
+                    ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                }
+            }
+
+            ctx->ControlInstr++;
+            bool taken = !idex.branch_needed || branch_taken(idex.instr_type, idex.rs1val, idex.rs2val);
+            uint32_t target = !taken        ? idex.next_pc
+                              : idex.jalr ? idex.rs1val + idex.imm
+                                          : idex.pc + idex.imm;
+            uint32_t after = fetched_next();
+            if (idex.link != predictors::Link::None)
+                brpre.returns.resolved(idex.link, after == target);
+            if (after != target)
+                control_hazard(target, true);
+            brpre.update(idex.pc, taken, target);
+            if (changes)
+                record_prediction(idex.pc);
+        }
+
+        void hazard_detection()
+        {
+            // decode and execute already wrote this cycle's latches, F/D is still the current one
+            buffers &buf = nxt();
+            bool stall = false;
+            if (buf.idex.pc == NO_PC)
+                return;
+            // data hazard
+            if (buf.exmem.pc != NO_PC && buf.exmem.rd != 0 && (buf.idex.rs1 == buf.exmem.rd || buf.idex.rs2 == buf.exmem.rd))
+            {
+                ctx->data_hazards++;
+                if (Policy::hazard_trace)
+                {
+                    appendToConsole(" ");
+                    appendToConsole("!!EXECUTE STAGE DATA HAZARD DETECTED!!");
+                }
+                ctx->hazards.push_back({"Data", "ID/EX", hex32(buf.idex.instr), "EX/MEM", hex32(buf.exmem.instr)});
+                if (!Policy::forwarding || buf.exmem.opcode == OP_LOAD)
+                {
+                    // a load's value is only available after the memory stage, so even forwarding has to stall
+                    ctx->data_stalls++;
+                    if (Policy::hazard_trace)
+                    {
+                        appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                        appendToConsole(" ");
+                    }
+                    hold_decode();
+                    buf.idex.flush();
+                    stall = true;
+                }
+                else // do forwarding
+                {
+                    if (Policy::hazard_trace)
+                    {
+                        appendToConsole("DATA FORWARDING");
+                        appendToConsole("From Instruction " + hex32(buf.exmem.instr) + ": EXECUTE Stage");
+                        appendToConsole("To Instruction " + hex32(buf.idex.instr) + ": DECODE Stage");
+                        appendToConsole(" ");
+                    }
+                    if (buf.idex.rs1 == buf.exmem.rd)
+                    {
+                        buf.idex.rs1val = buf.exmem.exe_out;
+                        ctx->dp.ra = buf.idex.rs1val;
+                        ctx->forwardingPaths.push_back({"EX/MEM", "ID/EX"});
+                    }
+                    if (buf.idex.rs2 == buf.exmem.rd)
+                    {
+                        buf.idex.rs2val = buf.exmem.exe_out;
+                        ctx->dp.rb = buf.idex.rs2val;
+                        ctx->forwardingPaths.push_back({"EX/MEM", "ID/EX"});
+                    }
+                }
+            }
+
+            // The string engine compares empty register fields here, so an ID/EX latch flushed by the
+            // stall above matches a bubble in MEM/WB. Kept so both engines count the same hazards.
+            bool idex_bubble = buf.idex.pc == NO_PC, memwb_bubble = buf.memwb.pc == NO_PC;
+            bool rs1_match = idex_bubble ? memwb_bubble : !memwb_bubble && buf.idex.rs1 == buf.memwb.rd;
+            bool rs2_match = idex_bubble ? memwb_bubble : !memwb_bubble && buf.idex.rs2 == buf.memwb.rd;
+            if ((memwb_bubble || buf.memwb.rd != 0) && (rs1_match || rs2_match))
+            {
+                ctx->data_hazards++;
+                if (Policy::hazard_trace)
+                {
+                    appendToConsole(" ");
+                    appendToConsole("!!MEMORY STAGE DATA HAZARD DETECTED!!");
+                }
+                ctx->hazards.push_back({"Data", "ID/EX", instr_str(buf.idex.pc, buf.idex.instr), "MEM/WB", instr_str(buf.memwb.pc, buf.memwb.instr)});
+                if (!Policy::forwarding)
+                {
+                    ctx->data_stalls++;
+                    if (Policy::hazard_trace)
+                    {
+                        if (!stall)
+                            appendToConsole("STALLING THE PIPELINE FOR 1 CYCLE");
+                        else
+                            appendToConsole("!!STALLED ALREADY!!");
+                        appendToConsole(" ");
+                    }
+                    hold_decode();
+                    buf.idex.flush();
+                    stall = true;
+                }
+                else
+                {
+                    if (Policy::hazard_trace)
+                    {
+                        appendToConsole("DATA FORWARDING");
+                        appendToConsole("From Instruction " + instr_str(buf.memwb.pc, buf.memwb.instr) + ": MEMORY Stage");
+                        appendToConsole("To Instruction " + instr_str(buf.idex.pc, buf.idex.instr) + ": DECODE Stage");
+                        appendToConsole(" ");
+                    }
+                    if (rs1_match)
+                    {
+                        buf.idex.rs1val = ctx->dp.ry;
+                        ctx->dp.ra = buf.idex.rs1val;
+                        ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                    }
+                    if (rs2_match)
+                    {
+                        buf.idex.rs2val = ctx->dp.ry;
+                        ctx->dp.rb = buf.idex.rs2val;
+                        ctx->forwardingPaths.push_back({"MEM/WB", "ID/EX"});
+                    }
+                    buf.idex.operands_set = true;
+                }
+            }
+        }
+
+    public:
+        PMI_data &data_memory;
+        PMI_text &text_memory;
+        IAG iag;
+        RegisterFile registers;
+        ALU alu;
+        buffers bank[2]; // current and next latches
+        uint8_t live = 0;
+        typename Policy::predictor brpre;
+        pipeline_config config;
+        fetch_queue ifq;
+        bool decode_held = false; // set by decode for fetch in the same cycle, see hold_decode
+        decode_cache decoded;
+        StepDelta *changes = nullptr; // set while a step records its changes
+
+        void record_prediction(uint32_t pc)
+        {
+            changes->predictor.push_back({pc, brpre.btb_target(pc), brpre.predicts_taken(pc)});
+        }
+
+        functions(PMI_data &data_mem, PMI_text &text_mem)
+            : data_memory(data_mem), text_memory(text_mem) {}
+
+        // takes over the state of another instantiation
+        template <class Other>
+        functions(functions<Other> &&other)
+            : data_memory(other.data_memory), text_memory(other.text_memory), iag(other.iag), registers(other.registers),
+              alu(other.alu), live(other.live), brpre(move(other.brpre)), config(other.config), ifq(other.ifq),
+              decoded(move(other.decoded))
+        {
+            bank[0] = other.bank[0];
+            bank[1] = other.bank[1];
+        }
+
+        buffers &cur()
+        {
+            return bank[live];
+        }
+
+        buffers &nxt()
+        {
+            return bank[live ^ 1];
+        }
+
+        // the latches written this cycle become the current ones
+        void commit()
+        {
+            live ^= 1;
+        }
+
+        void fetch()
+        {
+            if (!config.queue_depth)
+            {
+                if (ifq.redirect || iag.use_return_addr)
+                    ifq.counters.front_end_bound++; // decode gets a bubble
+                if (!ifq.redirect)
+                {
+                    fetch_into(nxt().ifid);
+                    return;
+                }
+                ifq.redirect--;
+                ifq.counters.redirects++;
+                nxt().ifid = IFID_buffer();
+                nxt().ifid.redirecting = true;
+                return;
+            }
+
+            ifq.counters.cycles++;
+            // at most queue_depth instructions stay queued after the hand-off to F/D below
+            unsigned room = config.queue_depth + (decode_held ? 0 : 1);
+            bool past_text = false, redirecting = false;
+            if (iag.use_return_addr)
+                iag.compute_nextPC(); // this cycle's fetch was squashed by a misprediction
+            else if (ifq.redirect)
+            {
+                ifq.redirect--;
+                ifq.counters.redirects++;
+                redirecting = true;
+            }
+            else
+            {
+                for (unsigned i = 0; i < config.fetch_width; i++)
+                {
+                    if (ifq.count >= room)
+                    {
+                        ifq.counters.full++;
+                        break;
+                    }
+                    IFID_buffer entry;
+                    bool taken = fetch_into(entry);
+                    if (entry.pc == NO_PC)
+                    {
+                        past_text = true;
+                        break;
+                    }
+                    ifq.push(entry);
+                    if (taken)
+                        break; // the rest of the group would have been on the fall through path
+                }
+            }
+
+            IFID_buffer &ifid = nxt().ifid;
+            if (decode_held)
+                ifid = cur().ifid;
+            else if (ifq.count)
+                ifid = ifq.pop();
+            else
+            {
+                ifid = IFID_buffer();
+                ifid.redirecting = redirecting;
+                if (!past_text)
+                    ifq.counters.front_end_bound++;
+            }
+            decode_held = false;
+            ifq.counters.occupancy += ifq.count;
+        }
+
+        // Fetches the instruction at iag.pc into ifid, a bubble past the text or when a
+        // misprediction redirects fetch, and moves iag on. True when it was predicted taken, which
+        // then costs pipeline_config::taken_penalty cycles of fetch.
+        bool fetch_into(IFID_buffer &ifid)
+        {
+            const decoded_instr *d = decoded.find(text_memory, iag.pc);
+            bool present = d != nullptr;
+            uint32_t instr = present ? d->instr : 0;
+            if (!present)
+            {
+                text_memory.MAR = hex32(iag.pc);
+                text_memory.load();
+                present = text_memory.MDR != "";
+                instr = parse_hex32(text_memory.MDR);
+            }
+
+            if (!present || iag.use_return_addr)
+            {
+                ifid.pc = NO_PC;
+                ifid.next_pc = NO_PC;
+                ifid.instr = 0;
+            }
+            else
+            {
+                ifid.pc = iag.pc;
+                ifid.next_pc = iag.pc + 4;
+                ifid.instr = instr;
+            }
+
+            pair<bool, uint32_t> prediction = brpre.predictBranch(ifid.pc);
+
+            ifid.link = predictors::Link::None;
+            ifid.redirecting = false;
+            if (brpre.returns.enabled() && ifid.pc != NO_PC)
+            {
+                ifid.ras = brpre.returns.save();
+                uint32_t target;
+                ifid.link = brpre.returns.fetched(ifid.pc, ifid.instr, target);
+                if (ifid.link == predictors::Link::Return)
+                    prediction = {true, target};
+            }
+
+            if (prediction.first)
+            {
+                iag.update(prediction.second, true);
+                ifq.redirect = config.taken_penalty;
+            }
+
+            iag.compute_nextPC();
+            return prediction.first;
+        }
+
+        void decode()
+        {
+            const IFID_buffer &ifid = cur().ifid;
+            if (ifid.pc == NO_PC)
+            {
+                nxt().idex.flush();
+                return;
+            }
+
+            // words outside the cache (e.g. only partially written) are decoded on the spot
+            const decoded_instr *cached = decoded.find(text_memory, ifid.pc);
+            decoded_instr local;
+            if (!cached || cached->instr != ifid.instr)
+            {
+                local = decode_word(ifid.instr);
+                cached = &local;
+            }
+            const decoded_instr &d = *cached;
+
+            IDEX_buffer &idex = nxt().idex;
+            idex = IDEX_buffer();
+            idex.opcode = d.opcode;
+            idex.rd = d.rd;
+            idex.funct3 = d.funct3;
+            idex.rs1 = d.rs1;
+            idex.rs2 = d.rs2;
+            idex.funct7 = d.funct7;
+            idex.imm = d.imm;
+            idex.instr_type = d.instr_type;
+            idex.instr = d.instr;
+            idex.pc = ifid.pc;
+            idex.next_pc = ifid.next_pc;
+            idex.mem_store_needed = d.mem_store_needed;
+            idex.mem_load_needed = d.mem_load_needed;
+            idex.wb_needed = d.wb_needed;
+            idex.branch_needed = d.branch_needed;
+            idex.jal = d.jal;
+            idex.jalr = d.jalr;
+            idex.link = ifid.link;
+
+            registers.rs1 = idex.rs1;
+            registers.rs2 = idex.rs2;
+            registers.readRS();
+            idex.rs1val = ctx->dp.ra;
+            idex.rs2val = ctx->dp.rb;
+            idex.operands_set = true;
+
+            if (config.branches_in_decode && (idex.branch_needed || idex.jal || idex.jalr))
+                resolve_in_decode();
+            else
+                hazard_detection();
+
+            alu.operation = idex.instr_type;
+        }
+
+        void execute()
+        {
+            IDEX_buffer &idex = cur().idex;
+            EXMEM_buffer &exmem = nxt().exmem;
+
+            if (idex.opcode != OP_R && idex.opcode != OP_BRANCH) // if instruction is I or load or store or jalr or auipc
+                ctx->dp.rb = idex.imm;
+
+            if (idex.opcode == OP_AUIPC)
+                ctx->dp.ra = idex.pc;
+
+            if (idex.pc != NO_PC && idex.instr != ECALL)
+            {
+                ctx->ALUInstr++;
+                alu.perform_op();
+            }
+
+            exmem = idex;
+            exmem.exe_out = ctx->dp.rz;
+            exmem.exe_out_set = ctx->dp.rz_set;
+
+            uint32_t ret_addr;
+            if (config.branches_in_decode)
+            {
+                // resolved by decode
+            }
+            else if (idex.branch_needed) // branch
+            {
+                ctx->ControlInstr++;
+                bool taken = exmem.exe_out == 1;
+                ret_addr = taken ? idex.pc + idex.imm : exmem.next_pc;
+                uint32_t next = fetched_after_decode();
+                if (next == NO_PC || next != ret_addr)
+                    control_hazard(ret_addr);
+                brpre.update(exmem.pc, taken, ret_addr);
+                if (changes)
+                    record_prediction(exmem.pc);
+            }
+            else if (idex.jal || idex.jalr)
+            {
+                ctx->ControlInstr++;
+                ret_addr = idex.jal ? idex.pc + idex.imm : exmem.exe_out;
+                uint32_t next = fetched_after_decode();
+                if (idex.link != predictors::Link::None)
+                    brpre.returns.resolved(idex.link, next == ret_addr);
+                if (next == NO_PC || next != ret_addr)
+                    control_hazard(ret_addr);
+                brpre.update(exmem.pc, true, ret_addr);
+                if (changes)
+                    record_prediction(exmem.pc);
+            }
+
+            if (exmem.opcode == OP_JAL || exmem.opcode == OP_JALR)
+            {
+                ctx->dp.rz = exmem.next_pc;
+                exmem.exe_out = ctx->dp.rz;
+            }
+        }
+
+        void accessMemory(uint32_t address, uint32_t data, uint32_t type)
+        {
+            if (cur().exmem.pc != NO_PC)
+            {
+                data_memory.store(static_cast<int32_t>(address), data, type);
+                ctx->DataTransferInstr++;
+                uint32_t size = type == 0 ? 1 : type == 1 ? 2 : 4;
+                if (changes)
+                    changes->stores.push_back({address, size, size == 4 ? data : data & ((1u << (8 * size)) - 1)});
+                if (ctx->watch.armed)
+                    ctx->watch.stored(address, size);
+            }
+            latch_memwb();
+        }
+        void accessMemory(uint32_t address, uint32_t type)
+        {
+            if (cur().exmem.pc != NO_PC)
+            {
+                ctx->dp.ry = data_memory.load(static_cast<int32_t>(address), type);
+                ctx->dp.ry_set = true;
+                ctx->DataTransferInstr++;
+            }
+            latch_memwb();
+        }
+        void accessMemory()
+        {
+            ctx->dp.ry = ctx->dp.rz;
+            ctx->dp.ry_set = ctx->dp.rz_set;
+            latch_memwb();
+        }
+
+        void latch_memwb()
+        {
+            nxt().memwb = cur().exmem;
+        }
+
+        void writeBack(bool &flag)
+        {
+            const MEMWB_buffer &memwb = cur().memwb;
+            if (memwb.pc != NO_PC && memwb.wb_needed)
+            {
+                registers.rd = memwb.rd;
+                registers.writeRD();
+                if (changes && memwb.rd != 0)
+                    changes->registers.push_back({memwb.rd, registers.regs[memwb.rd]});
+                if (ctx->watch.armed && memwb.rd != 0)
+                    ctx->watch.wrote_register(memwb.rd, registers.regs[memwb.rd]);
+            }
+            if (memwb.pc != NO_PC && memwb.instr == ECALL)
+                flag = false;
+            ctx->instructionCt++;
+        }
+    };
+
+    // Architectural state for the block executor while fast forwarding, see block_cache.cpp
+    struct forward_machine
+    {
+        uint32_t *regs = nullptr;
+        const blocks::micro_op *at = nullptr;
+        bool stop = false; // data stores cannot reach the text segment
+        PMI_data *data_memory = nullptr;
+        uint64_t executed = 0;
+
+        void write(uint8_t rd, uint32_t value)
+        {
+            if (rd != 0)
+                regs[rd] = value;
+        }
+
+        uint32_t link(uint32_t return_address)
+        {
+            return return_address;
+        }
+
+        uint32_t load(const blocks::micro_op &op, uint32_t address)
+        {
+            return data_memory->load(static_cast<int32_t>(address), op.funct3);
+        }
+
+        void store(const blocks::micro_op &op, uint32_t address, uint32_t value)
+        {
+            data_memory->store(static_cast<int32_t>(address), value, op.funct3);
+        }
+
+        void retire(const blocks::micro_op &op)
+        {
+            executed += op.count;
+        }
+    };
+
+    template <class Policy>
+    class control_circuitry : public engine
+    {
+        template <class>
+        friend class control_circuitry;
+
+        blocks::block_cache block_cache;
+
+    public:
+        functions<Policy> f;
+
+        control_circuitry(PMI_data &data_memory, PMI_text &text_memory)
+            : f(data_memory, text_memory)
+        {
+        }
+
+        template <class Other>
+        control_circuitry(control_circuitry<Other> &&other)
+            : block_cache(move(other.block_cache)), f(move(other.f))
+        {
+        }
+
+        engine *reconfigure(bool forwarding, bool spotlight, TraceLevel trace) override
+        {
+            bool shown = spotlight && trace != TraceLevel::Off;
+            if (forwarding == Policy::forwarding && shown == Policy::spotlight && trace == Policy::trace)
+                return this;
+            return instantiate<typename Policy::predictor>(forwarding, spotlight, trace, move(*this));
+        }
+
+        void step_cycle(bool &flag)
+        {
+            if (static_cast<uint64_t>(ctx->clock_cycle) == ctx->checkpoints.next_due)
+                ctx->checkpoints.add(ctx->clock_cycle, save());
+
+            // stages read the current latches and write the next ones, committed at the end
+            buffers &now = f.cur(), &next = f.nxt();
+            ctx->forwardingPaths.clear();
+            ctx->hazards.clear();
+            string &out = ctx->console.open;
+            if (Policy::cycle_trace)
+            {
+                out += "Cycle ";
+                out += to_string(ctx->clock_cycle + 1);
+                out += ":\n";
+            }
+
+            if (now.memwb.wb_needed)
+            {
+                f.writeBack(flag);
+                if (Policy::cycle_trace)
+                {
+                    out += "  W: PC=";
+                    put_pc(out, now.memwb.pc);
+                    out += " rd=x";
+                    out += to_string(f.registers.rd);
+                    out += " val=";
+                    if (ctx->dp.ry_set)
+                        put_hex32(out, ctx->dp.ry);
+                    out += '\n';
+                }
+
+                if (Policy::spotlight && spotlight(now.memwb.pc))
+                {
+                    appendToConsole(" ");
+                    appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Writeback.");
+                    appendToConsole("Contents of RegisterFile: ");
+                    for (int i = 0; i < 32; i++)
+                        appendToConsole("x" + to_string(i) + ":" + hex32(f.registers.regs[i]) + ";");
+                    appendToConsole(" ");
+                }
+            }
+            else if (Policy::cycle_trace)
+            {
+                out += "  W: PC=";
+                put_pc(out, now.memwb.pc);
+                out += '\n';
+            }
+
+            if (now.exmem.mem_load_needed)
+            {
+                f.accessMemory(ctx->dp.rz, now.exmem.funct3);
+                if (Policy::cycle_trace)
+                {
+                    out += "  M: PC=";
+                    put_pc(out, next.memwb.pc);
+                    out += " LOAD type=";
+                    put_bits(out, now.exmem.funct3, 3);
+                    out += " data=";
+                    put_hex32(out, ctx->dp.ry);
+                    out += " addr=";
+                    put_hex32(out, ctx->dp.rz);
+                    out += '\n';
+                }
+            }
+            else if (now.exmem.mem_store_needed)
+            {
+                f.accessMemory(ctx->dp.rz, now.exmem.rs2val, now.exmem.funct3);
+                if (Policy::cycle_trace)
+                {
+                    out += "  M: PC=";
+                    put_pc(out, next.memwb.pc);
+                    out += " STORE type=";
+                    put_bits(out, now.exmem.funct3, 3);
+                    out += " data=";
+                    put_hex32(out, now.exmem.rs2val);
+                    out += " addr=";
+                    put_hex32(out, ctx->dp.rz);
+                    out += '\n';
+                }
+            }
+            else
+            {
+                f.accessMemory();
+                if (Policy::cycle_trace)
+                {
+                    out += "  M: PC=";
+                    put_pc(out, next.memwb.pc);
+                    out += '\n';
+                }
+            }
+
+            if (Policy::spotlight && spotlight(now.exmem.pc))
+            {
+                appendToConsole(" ");
+                appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Memory stage.");
+                appendToConsole("Contents of Exe/Mem buffer: PC=" + pc_str(now.exmem.pc) + ", Instr=" + instr_str(now.exmem.pc, now.exmem.instr) +
+                                ", ALU Result=" + (now.exmem.exe_out_set ? hex32(now.exmem.exe_out) : "") +
+                                ", rs2val=" + val_str(now.exmem.operands_set, now.exmem.rs2val));
+                appendToConsole(" ");
+            }
+
+            f.execute();
+            if (Policy::cycle_trace)
+            {
+                out += "  E: PC=";
+                put_pc(out, next.exmem.pc);
+                out += " op=";
+                out += op_name(f.alu.operation);
+                out += " result=";
+                if (ctx->dp.rz_set)
+                    put_hex32(out, ctx->dp.rz);
+                out += '\n';
+            }
+
+            if (Policy::spotlight && spotlight(now.idex.pc))
+            {
+                appendToConsole(" ");
+                appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Execute stage.");
+                appendToConsole("Contents of Dec/Exe buffer: PC=" + pc_str(now.idex.pc) + ", Instr=" + instr_str(now.idex.pc, now.idex.instr) +
+                                ", rs1val=" + val_str(now.idex.operands_set, now.idex.rs1val) + ", rs2val=" + val_str(now.idex.operands_set, now.idex.rs2val) +
+                                ", Imm=" + (now.idex.pc == NO_PC ? "" : imm_str(now.idex.imm)) + ", ALU Operation=" + op_name(f.alu.operation));
+                appendToConsole(" ");
+            }
+
+            f.decode();
+            if (Policy::cycle_trace)
+            {
+                if (next.idex.pc == NO_PC)
+                    out += "  D: PC=ffffffff opcode= rd= rs1= rs2= type=\n";
+                else
+                {
+                    out += "  D: PC=";
+                    put_hex32(out, next.idex.pc);
+                    out += " opcode=";
+                    put_bits(out, next.idex.opcode, 7);
+                    out += " rd=";
+                    put_bits(out, next.idex.rd, 5);
+                    out += " rs1=";
+                    put_bits(out, next.idex.rs1, 5);
+                    out += " rs2=";
+                    put_bits(out, next.idex.rs2, 5);
+                    out += " type=";
+                    out += op_name(next.idex.instr_type);
+                    out += '\n';
+                }
+            }
+
+            if (Policy::spotlight && spotlight(now.ifid.pc))
+            {
+                appendToConsole(" ");
+                appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Decode stage.");
+                appendToConsole("Contents of F/Dec buffer: PC=" + pc_str(now.ifid.pc) + ", Instr=" + instr_str(now.ifid.pc, now.ifid.instr) +
+                                ", Control Instruction=" + (next.idex.branch_needed ? "Yes" : "No") +
+                                ", BTB Hit=" + (f.brpre.btb_hit(now.ifid.pc) ? "Yes" : "No"));
+                appendToConsole(" ");
+            }
+
+            f.fetch();
+            if (ctx->watch.armed && next.ifid.pc != NO_PC)
+                ctx->watch.fetched(next.ifid.pc);
+            if (Policy::cycle_trace)
+            {
+                out += "  F: PC=";
+                put_pc(out, next.ifid.pc);
+                out += " Instr=";
+                if (next.ifid.pc != NO_PC)
+                    put_hex32(out, next.ifid.instr);
+                out += "\n \n";
+            }
+
+            if (Policy::spotlight && spotlight(next.ifid.pc))
+            {
+                appendToConsole(" ");
+                appendToConsole("Instruction at PC " + ctx->printPipelineForInstruction + " completes Fetch stage.");
+                appendToConsole("Contents of F/Dec buffer: PC=" + pc_str(next.ifid.pc) + ", IR=" + instr_str(next.ifid.pc, next.ifid.instr));
+                appendToConsole(" ");
+            }
+
+            f.commit();
+            ctx->clock_cycle++;
+            if (Policy::cycle_trace)
+                ctx->console.settle(); // out was written directly
+            if (Policy::summary_trace && !flag)
+                trace_summary();
+            if (HistoryEntry *entry = ctx->history.record(ctx->clock_cycle))
+                record_history(*entry);
+        }
+
+        bool run_cycles() override
+        {
+            bool flag = true;
+            while (flag && !ctx->watch.hit)
+                step_cycle(flag);
+            return flag;
+        }
+
+        bool step() override
+        {
+            bool flag = true;
+            step_cycle(flag);
+            return flag;
+        }
+
+        RunStatus run(const RunLimits &limits, uint64_t &cycles) override
+        {
+            auto step_one = [this]()
+            {
+                bool flag = true;
+                step_cycle(flag);
+                return flag;
+            };
+            auto fetched = [this]()
+            {
+                return f.cur().ifid.pc;
+            };
+            return run_bounded(limits, cycles, step_one, fetched);
+        }
+
+        // Executes up to count instructions functionally, without modelling the pipeline. The
+        // instructions in flight restart from the oldest one, whole blocks run from the block
+        // cache and the pipeline refills empty at the pc reached. Cycle, hazard and predictor
+        // state are left alone. Stops before an ecall or an instruction blocks cannot run, and at
+        // a failing memory access (already reported on the console). Returns the instructions run.
+        uint64_t fast_forward(uint64_t count) override
+        {
+            const buffers &buf = f.cur();
+            uint32_t pc = buf.memwb.pc != NO_PC  ? buf.memwb.pc
+                          : buf.exmem.pc != NO_PC ? buf.exmem.pc
+                          : buf.idex.pc != NO_PC  ? buf.idex.pc
+                          : buf.ifid.pc != NO_PC  ? buf.ifid.pc
+                          : f.ifq.count           ? f.ifq.front().pc
+                          : f.iag.use_return_addr ? f.iag.return_addr
+                                                  : f.iag.pc;
+
+            forward_machine m;
+            m.regs = f.registers.regs;
+            m.data_memory = &f.data_memory;
+            const PagedMemory &text = f.text_memory.mem.memory;
+            try
+            {
+                while (m.executed < count)
+                {
+                    const blocks::block *b = &block_cache.lookup(pc, text, f.text_memory.version);
+                    blocks::block single;
+                    if (b->count > count - m.executed)
+                    {
+                        single = blocks::build(pc, text, 1);
+                        b = &single;
+                    }
+                    if (b->ops.empty())
+                        break;
+                    pc = blocks::execute(m, *b);
+                }
+            }
+            catch (const exception &)
+            {
+                pc = m.at->pc;
+            }
+
+            f.bank[0] = f.bank[1] = buffers();
+            f.ifq.clear();
+            f.iag.pc = pc;
+            f.iag.return_addr = 0;
+            f.iag.use_return_addr = false;
+            return m.executed;
+        }
+
+        // Writes the integer state into the string structures read by the API
+        void export_state(::IAG &iag, ::RegisterFile &registers, ::buffers &view, ::BranchPredictor &brpre) override
+        {
+            iag.pc = hex32(f.iag.pc);
+            iag.return_addr = hex32(f.iag.return_addr);
+            iag.use_return_addr = f.iag.use_return_addr;
+
+            for (int i = 0; i < 32; i++)
+                registers.regs[i] = hex32(f.registers.regs[i]);
+            registers.rd = f.registers.rd;
+
+            const buffers &buf = f.cur();
+            view.ifid.pc = pc_str(buf.ifid.pc);
+            view.ifid.next_pc = pc_str(buf.ifid.next_pc);
+            view.ifid.instr = instr_str(buf.ifid.pc, buf.ifid.instr);
+            export_latch(view.idex, buf.idex);
+            view.idex.mem_store_needed = buf.idex.mem_store_needed;
+            view.idex.mem_load_needed = buf.idex.mem_load_needed;
+            view.idex.wb_needed = buf.idex.wb_needed;
+            view.idex.branch_needed = buf.idex.branch_needed;
+            view.idex.jal = buf.idex.jal;
+            view.idex.jalr = buf.idex.jalr;
+            export_latch(view.exmem, buf.exmem);
+            view.exmem.exe_out = buf.exmem.exe_out_set ? hex32(buf.exmem.exe_out) : "";
+            view.exmem.mem_store_needed = buf.exmem.mem_store_needed;
+            view.exmem.mem_load_needed = buf.exmem.mem_load_needed;
+            view.exmem.wb_needed = buf.exmem.wb_needed;
+            export_latch(view.memwb, buf.memwb);
+            view.memwb.exe_out = buf.memwb.exe_out_set ? hex32(buf.memwb.exe_out) : "";
+            view.memwb.wb_needed = buf.memwb.wb_needed;
+
+            brpre.BTB.clear();
+            brpre.BHT.clear();
+            auto show = [&](uint32_t pc, const uint32_t *target, bool taken)
+            {
+                if (target)
+                    brpre.BTB[hex32(pc)] = hex32(*target);
+                brpre.BHT[hex32(pc)] = taken;
+            };
+            f.brpre.for_each(show);
+
+            ctx->ry = ctx->dp.ry_set ? hex32(ctx->dp.ry) : "";
+        }
+
+        // One cycle that records its changes in delta
+        void step_with_delta(StepDelta &delta) override
+        {
+            StateBlock before, after;
+            export_latches(before);
+            delta.clear();
+            f.changes = &delta;
+            try
+            {
+                delta.more = step();
+            }
+            catch (...)
+            {
+                f.changes = nullptr;
+                throw;
+            }
+            f.changes = nullptr;
+
+            export_latches(after);
+            delta.pc = f.iag.pc;
+            delta.latches = (memcmp(&before.ifid, &after.ifid, sizeof(LatchState)) ? DELTA_IFID : 0) |
+                            (memcmp(&before.idex, &after.idex, sizeof(LatchState)) ? DELTA_IDEX : 0) |
+                            (memcmp(&before.exmem, &after.exmem, sizeof(LatchState)) ? DELTA_EXMEM : 0) |
+                            (memcmp(&before.memwb, &after.memwb, sizeof(LatchState)) ? DELTA_MEMWB : 0);
+        }
+
+        shared_ptr<engine_state> save() override
+        {
+            auto state = make_shared<saved_state<typename Policy::predictor>>();
+            state->data = f.data_memory.mem.memory;
+            state->save_context();
+            state->iag = f.iag;
+            state->registers = f.registers;
+            state->alu = f.alu;
+            state->bank[0] = f.bank[0];
+            state->bank[1] = f.bank[1];
+            state->live = f.live;
+            state->ifq = f.ifq;
+            state->brpre = f.brpre;
+            return state;
+        }
+
+        bool restore(const engine_state &state) override
+        {
+            auto saved = dynamic_cast<const saved_state<typename Policy::predictor> *>(&state);
+            if (!saved)
+                return false;
+            f.data_memory.mem.memory = saved->data;
+            f.data_memory.mem.memory.mark_all_dirty();
+            saved->restore_context();
+            f.iag = saved->iag;
+            f.registers = saved->registers;
+            f.alu = saved->alu;
+            f.bank[0] = saved->bank[0];
+            f.bank[1] = saved->bank[1];
+            f.live = saved->live;
+            f.ifq = saved->ifq;
+            f.brpre = saved->brpre;
+            return true;
+        }
+
+        void configure_predictor(const predictors::config &config) override
+        {
+            f.brpre.configure(config);
+        }
+
+        void configure_pipeline(const pipeline_config &config) override
+        {
+            f.config = config;
+            f.ifq = fetch_queue();
+        }
+
+        const fetch_queue_counters *fetch_counters() override
+        {
+            return f.config.queue_depth || f.config.taken_penalty ? &f.ifq.counters : nullptr;
+        }
+
+        const predictors::btb_counters *btb_counters() override
+        {
+            return f.brpre.btb_counters();
+        }
+
+        const predictors::ras_counters *ras_counters() override
+        {
+            return f.brpre.ras_counters();
+        }
+
+        void reset() override
+        {
+            f.iag = IAG();
+            f.registers = RegisterFile();
+            f.alu = ALU();
+            f.bank[0] = buffers();
+            f.bank[1] = buffers();
+            f.live = 0;
+            f.ifq = fetch_queue();
+            f.brpre.clear();
+        }
+
+        void record_history(HistoryEntry &entry) override
+        {
+            const buffers &buf = f.cur();
+            entry.pc = f.iag.pc;
+            entry.flags = (buf.ifid.pc == NO_PC ? HistoryEntry::IFID_BUBBLE : 0) | (buf.idex.pc == NO_PC ? HistoryEntry::IDEX_BUBBLE : 0) |
+                          (buf.exmem.pc == NO_PC ? HistoryEntry::EXMEM_BUBBLE : 0) | (buf.memwb.pc == NO_PC ? HistoryEntry::MEMWB_BUBBLE : 0) |
+                          (buf.exmem.exe_out_set ? HistoryEntry::OUT_SET : 0) | (ctx->dp.ry_set ? HistoryEntry::RY_SET : 0);
+            entry.ifid_pc = buf.ifid.pc;
+            entry.ifid_instr = buf.ifid.instr;
+            entry.idex_instr = buf.idex.instr;
+            entry.idex_imm = buf.idex.imm;
+            entry.idex_regs = buf.idex.rs1 | buf.idex.rs2 << 5 | buf.idex.rd << 10;
+            entry.exmem_instr = buf.exmem.instr;
+            entry.exmem_out = buf.exmem.exe_out;
+            entry.exmem_type = static_cast<uint8_t>(buf.exmem.instr_type);
+            entry.memwb_instr = buf.memwb.instr;
+            entry.memwb_rd = buf.memwb.rd;
+            entry.ry = ctx->dp.ry;
+            CycleHistory::encode_links(entry, ctx->forwardingPaths, ctx->hazards);
+        }
+
+        // Fills everything in the state block but the header and the statistics
+        void export_block(StateBlock &block, vector<PredictorEntry> &entries) override
+        {
+            block.pc = f.iag.pc;
+            memcpy(block.regs, f.registers.regs, sizeof(block.regs));
+            export_latches(block);
+            block.ry = ctx->dp.ry_set ? ctx->dp.ry : 0;
+            block.ry_set = ctx->dp.ry_set;
+
+            entries.clear();
+            f.brpre.for_each([&](uint32_t pc, const uint32_t *target, bool taken)
+                             { entries.push_back({pc, target ? *target : 0, taken}); });
+            sort(entries.begin(), entries.end(), [](const PredictorEntry &a, const PredictorEntry &b)
+                 { return a.pc < b.pc; });
+        }
+
+    private:
+        void export_latches(StateBlock &block)
+        {
+            const buffers &buf = f.cur();
+            block.ifid = LatchState();
+            block.ifid.pc = buf.ifid.pc;
+            block.ifid.next_pc = buf.ifid.next_pc;
+            block.ifid.instr = buf.ifid.pc == NO_PC ? 0 : buf.ifid.instr;
+            // only the flags the string latches have, E/M and M/W carry the rest along unused
+            block_latch(block.idex, buf.idex, ~LATCH_EXE_OUT);
+            block_latch(block.exmem, buf.exmem, LATCH_OPERANDS | LATCH_EXE_OUT | LATCH_MEM_STORE | LATCH_MEM_LOAD | LATCH_WB);
+            block_latch(block.memwb, buf.memwb, LATCH_OPERANDS | LATCH_EXE_OUT | LATCH_WB);
+        }
+
+        static void block_latch(LatchState &state, const instr_latch &latch, uint32_t flags)
+        {
+            state = LatchState();
+            state.pc = latch.pc;
+            state.next_pc = latch.next_pc;
+            if (latch.pc == NO_PC)
+                return;
+            state.instr = latch.instr;
+            state.imm = latch.imm;
+            state.rs1val = latch.operands_set ? latch.rs1val : 0;
+            state.rs2val = latch.operands_set ? latch.rs2val : 0;
+            state.exe_out = latch.exe_out_set ? latch.exe_out : 0;
+            state.opcode = latch.opcode;
+            state.rd = latch.rd;
+            state.rs1 = latch.rs1;
+            state.rs2 = latch.rs2;
+            state.funct3 = latch.funct3;
+            state.funct7 = latch.funct7;
+            state.instr_type = static_cast<uint32_t>(latch.instr_type);
+            state.flags = (latch.operands_set ? LATCH_OPERANDS : 0) | (latch.exe_out_set ? LATCH_EXE_OUT : 0) |
+                          (latch.mem_store_needed ? LATCH_MEM_STORE : 0) | (latch.mem_load_needed ? LATCH_MEM_LOAD : 0) |
+                          (latch.wb_needed ? LATCH_WB : 0) | (latch.branch_needed ? LATCH_BRANCH : 0) |
+                          (latch.jal ? LATCH_JAL : 0) | (latch.jalr ? LATCH_JALR : 0);
+            state.flags &= flags;
+            if (!(flags & LATCH_EXE_OUT))
+                state.exe_out = 0;
+        }
+
+        template <typename View, typename Latch>
+        static void export_latch(View &view, const Latch &latch)
+        {
+            bool bubble = latch.pc == NO_PC;
+            view.pc = pc_str(latch.pc);
+            view.next_pc = pc_str(latch.next_pc);
+            view.instr = instr_str(latch.pc, latch.instr);
+            view.opcode = bubble ? "" : bits(latch.opcode, 7);
+            view.rd = bubble ? "" : bits(latch.rd, 5);
+            view.funct3 = bubble ? "" : bits(latch.funct3, 3);
+            view.rs1 = bubble ? "" : bits(latch.rs1, 5);
+            view.rs2 = bubble ? "" : bits(latch.rs2, 5);
+            view.funct7 = bubble ? "" : bits(latch.funct7, 7);
+            view.imm = bubble ? "" : imm_str(latch.imm);
+            view.instr_type = op_name(latch.instr_type);
+            view.rs1val = val_str(latch.operands_set, latch.rs1val);
+            view.rs2val = val_str(latch.operands_set, latch.rs2val);
+        }
+    };
+
+    // Builds the instantiation for the given settings from args, which are either the memories of
+    // a new engine or another control_circuitry to take over
+    template <bool Forwarding, bool Spotlight, class Predictor, class... Args>
+    engine *instantiate_traced(TraceLevel trace, Args &&...args)
+    {
+        switch (trace)
+        {
+        case TraceLevel::Off: // nothing is printed, so the spotlight is dropped too
+            return new control_circuitry<policy<Forwarding, false, TraceLevel::Off, Predictor>>(forward<Args>(args)...);
+        case TraceLevel::Summary:
+            return new control_circuitry<policy<Forwarding, Spotlight, TraceLevel::Summary, Predictor>>(forward<Args>(args)...);
+        case TraceLevel::Hazards:
+            return new control_circuitry<policy<Forwarding, Spotlight, TraceLevel::Hazards, Predictor>>(forward<Args>(args)...);
+        default:
+            return new control_circuitry<policy<Forwarding, Spotlight, TraceLevel::Full, Predictor>>(forward<Args>(args)...);
+        }
+    }
+
+    template <class Predictor, class... Args>
+    engine *instantiate(bool forwarding, bool spotlight, TraceLevel trace, Args &&...args)
+    {
+        if (forwarding && spotlight)
+            return instantiate_traced<true, true, Predictor>(trace, forward<Args>(args)...);
+        if (forwarding)
+            return instantiate_traced<true, false, Predictor>(trace, forward<Args>(args)...);
+        if (spotlight)
+            return instantiate_traced<false, true, Predictor>(trace, forward<Args>(args)...);
+        return instantiate_traced<false, false, Predictor>(trace, forward<Args>(args)...);
+    }
+}
+
+// Outcome of a bounded run, a plain object on the JavaScript side
+struct RunResult
+{
+    string status;
+    int cycles;
+};
+
+// Class to expose to JavaScript
+class RiscVPipelinedSimulator
+{
+public:
+    RiscVPipelinedSimulator() : initialized(false), engine("fast") {}
+
+    ~RiscVPipelinedSimulator()
+    {
+        cleanup();
+    }
+
+    RiscVPipelinedSimulator(const RiscVPipelinedSimulator &) = delete;
+    RiscVPipelinedSimulator &operator=(const RiscVPipelinedSimulator &) = delete;
+
+    string assemble(const string &code)
+    {
+        context_scope scope(context);
+        return ::assemble(code);
+    }
+
+    void init()
+    {
+        context_scope scope(context);
+        generation++;
+        if (initialized)
+        {
+            cleanup();
+        }
+        clearConsole();
+
+        data_memory = new PMI_data();
+        text_memory = new PMI_text();
+        newProcessor();
+        if (engine == "fast")
+            fast_engine = newFastEngine();
+        restart();
+        initialized = true;
+        program_loaded = false;
+        ctx->printPipelineForInstruction = "";
+        appendToConsole("=> Simulator initialized");
+    }
+
+    void cleanup()
+    {
+        context_scope scope(context);
+        if (initialized)
+        {
+            delete data_memory;
+            delete text_memory;
+            delete iag;
+            delete registers;
+            delete alu;
+            delete latches;
+            delete brpre;
+            delete control;
+            delete fast_engine;
+
+            data_memory = nullptr;
+            text_memory = nullptr;
+            iag = nullptr;
+            registers = nullptr;
+            alu = nullptr;
+            latches = nullptr;
+            brpre = nullptr;
+            control = nullptr;
+            fast_engine = nullptr;
+
+            initialized = false;
+        }
+    }
+
+    void loadCode(const string &codeStr)
+    {
+        context_scope scope(context);
+        generation++;
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        clearConsole();
+        ctx->checkpoints.reset(ctx->clock_cycle);
+
+        stringstream ss(codeStr);
+        string line;
         bool memory_flag = false;
 
         while (getline(ss, line))
         {
-            cout << line << endl;
             if (line.empty())
             {
                 memory_flag = true;
@@ -1621,9 +3994,9 @@ public:
             {
                 string addr = line.substr(2, 8);
                 string code = "000000" + line.substr(11, 2);
-                g_data_memory->MAR = addr;
-                g_data_memory->MDR = code;
-                g_data_memory->store("000");
+                data_memory->MAR = addr;
+                data_memory->MDR = code;
+                data_memory->store("000");
             }
             else
             {
@@ -1637,292 +4010,1221 @@ public:
                 string codeStr = line.substr(2, line.find_first_of(' ') - 2);
 
                 // Store in memory
-                g_text_memory->MAR = addrStr;
-                g_text_memory->MDR = codeStr;
-                g_text_memory->store();
+                text_memory->MAR = addrStr;
+                text_memory->MDR = codeStr;
+                text_memory->store();
             }
         }
 
+        loaded_data = data_memory->mem.memory; // shares the pages until the program writes them
+        program_loaded = true;
         appendToConsole("=> Code loaded successfully");
     }
 
     bool step()
     {
+        context_scope scope(context);
+        generation++;
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        if (!g_running)
+        if (!running)
         {
             appendToConsole("=> Simulation has ended");
             return false;
         }
 
-        return g_control->step();
+        ctx->watch.reset_hit();
+        bool more = fast_engine ? fast_engine->step() : control->step();
+        if (!more)
+            running = false;
+        reportWatch();
+        return more;
     }
 
+    // Runs to the ecall, or until a breakpoint or watchpoint is hit
     void run()
     {
+        context_scope scope(context);
+        generation++;
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        if (!g_running)
+        if (!running)
         {
             appendToConsole("=> Simulation has ended");
             return;
         }
 
-        g_control->run_cycles();
+        ctx->watch.reset_hit();
+        if (!(fast_engine ? fast_engine->run_cycles() : control->run_cycles()))
+            running = false;
+        reportWatch();
+    }
+
+    // Bounded versions of run() for callers that must stay responsive, e.g. a UI running slices
+    // of a program that may never reach its ecall. Each returns why it stopped ("halted",
+    // "cycles", "pc", "time" or "watch") and how many cycles it ran.
+    RunResult runCycles(int count)
+    {
+        context_scope scope(context);
+        RunLimits limits;
+        limits.cycles = count > 0 ? count : 0;
+        return runBounded(limits);
+    }
+
+    // Stops once the instruction at pc has been fetched, or after maxCycles
+    RunResult runUntilPC(int pc, int maxCycles)
+    {
+        context_scope scope(context);
+        RunLimits limits;
+        limits.has_stop_pc = true;
+        limits.stop_pc = static_cast<uint32_t>(pc);
+        limits.cycles = maxCycles > 0 ? maxCycles : 0;
+        return runBounded(limits);
+    }
+
+    RunResult runForMillis(double millis)
+    {
+        context_scope scope(context);
+        RunLimits limits;
+        limits.millis = millis;
+        if (millis <= 0)
+            limits.cycles = 0;
+        return runBounded(limits);
+    }
+
+    // Binary snapshot of the simulator, see StateBlock. The view points into the wasm heap and is
+    // detached when the heap grows, so fetch it again instead of keeping it across calls.
+    emscripten::val getStateView()
+    {
+        context_scope scope(context);
+        const StateBlock &block = stateBlock();
+        return emscripten::val(emscripten::typed_memory_view(sizeof(StateBlock) / 4, reinterpret_cast<const uint32_t *>(&block)));
+    }
+
+    // Predictor entries of the last state block, three words (pc, target, taken) each
+    emscripten::val getPredictorView()
+    {
+        context_scope scope(context);
+        stateBlock();
+        return emscripten::val(emscripten::typed_memory_view(predictor_entries.size() * 3, reinterpret_cast<const uint32_t *>(predictor_entries.data())));
+    }
+
+    // Steps one cycle like step() and returns what it changed as 32 bit words:
+    //   more, pc, latch bits (DELTA_*),
+    //   register count, then register and value for each,
+    //   store count, then address, size and value for each,
+    //   predictor count, then pc, target and taken for each updated entry.
+    // Only the fast engine records changes.
+    emscripten::val stepWithDelta()
+    {
+        context_scope scope(context);
+        stepDelta();
+
+        delta_words.clear();
+        delta_words.push_back(delta.more);
+        delta_words.push_back(delta.pc);
+        delta_words.push_back(delta.latches);
+        delta_words.push_back(delta.registers.size());
+        for (const auto &reg : delta.registers)
+        {
+            delta_words.push_back(reg.first);
+            delta_words.push_back(reg.second);
+        }
+        delta_words.push_back(delta.stores.size());
+        for (const auto &store : delta.stores)
+        {
+            delta_words.push_back(store.address);
+            delta_words.push_back(store.size);
+            delta_words.push_back(store.value);
+        }
+        delta_words.push_back(delta.predictor.size());
+        for (const auto &entry : delta.predictor)
+        {
+            delta_words.push_back(entry.pc);
+            delta_words.push_back(entry.target);
+            delta_words.push_back(entry.taken);
+        }
+        return emscripten::val(emscripten::typed_memory_view(delta_words.size(), delta_words.data()));
+    }
+
+    // stepWithDelta for native callers
+    const StepDelta &stepDelta()
+    {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (!fast_engine)
+        {
+            throw runtime_error("Step deltas need the fast engine");
+        }
+
+        generation++;
+        delta.clear();
+        if (!running)
+        {
+            appendToConsole("=> Simulation has ended");
+            delta.more = false;
+            return delta;
+        }
+
+        ctx->watch.reset_hit();
+        fast_engine->step_with_delta(delta);
+        if (!delta.more)
+            running = false;
+        reportWatch();
+        return delta;
+    }
+
+    // The same snapshot for native callers
+    const StateBlock &stateBlock()
+    {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (state_block.layout != STATE_LAYOUT || state_block.generation != generation)
+            fillStateBlock();
+        return state_block;
+    }
+
+    const vector<PredictorEntry> &predictorEntries()
+    {
+        context_scope scope(context);
+        stateBlock();
+        return predictor_entries;
+    }
+
+    // Runs up to count instructions functionally on the fast engine to skip ahead cheaply, then
+    // lets the pipeline refill from there. Timing statistics do not include the skipped part.
+    // Returns how many instructions ran; fewer than count when an ecall, an unsupported
+    // instruction or a memory error is reached, which the pipeline then handles as usual.
+    int fastForward(int count)
+    {
+        context_scope scope(context);
+        generation++;
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (!fast_engine)
+        {
+            throw runtime_error("Fast forward needs the fast engine");
+        }
+
+        if (!running || count <= 0)
+            return 0;
+
+        // the cycles skipped have no pipeline states, and replaying cannot skip them
+        ctx->history.clear();
+        ctx->checkpoints.reset(ctx->clock_cycle);
+        return static_cast<int>(fast_engine->fast_forward(count));
     }
 
     void reset()
     {
+        context_scope scope(context);
         cleanup();
         init();
         appendToConsole("=> Simulator reset");
     }
 
+    // Starts the loaded program over without parsing it again: the data segment goes back to
+    // how loadCode left it and the registers, latches, predictor and statistics to their
+    // initial values. Forwarding, the trace level, the spotlight, watches and the decoded text
+    // are kept, so rerunning with other settings costs no reload.
+    void resetState()
+    {
+        context_scope scope(context);
+        generation++;
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (!program_loaded)
+        {
+            throw runtime_error("No program loaded");
+        }
+
+        clearConsole();
+        data_memory->mem.memory = loaded_data;
+        data_memory->mem.memory.mark_all_dirty();
+        text_memory->mem.memory.mark_all_dirty();
+        newProcessor();
+        if (engine != "fast")
+        {
+            delete fast_engine;
+            fast_engine = nullptr;
+        }
+        else if (fast_engine)
+        {
+            fast_engine->reset();
+            fast_engine->configure_predictor(predictor);
+            fast_engine->configure_pipeline(pipeline);
+        }
+        else
+            fast_engine = newFastEngine();
+        restart();
+        appendToConsole("=> Simulator reset");
+    }
+
     string showReg()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
+        syncState();
 
-        return g_registers->getAllRegisters();
+        return registers->getAllRegisters();
     }
 
     string showMem(const string &segment, int startAddr, int count)
     {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (segment == "text")
+            return text_memory->getMemoryContent(startAddr, count);
+        return data_memory->getMemoryContent(startAddr, count);
+    }
+
+    // Like showMem, but only the rows written since that window was last shown, so a memory
+    // view can stay live during long runs. The first call after loadCode reports the program.
+    // Changes are tracked per 64 byte line, so it suits one live view per segment: windows
+    // sharing a line take each other's changes.
+    string showMemChanges(const string &segment, int startAddr, int count)
+    {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
         if (segment == "text")
-            return g_text_memory->getMemoryContent(startAddr, count);
-        return g_data_memory->getMemoryContent(startAddr, count);
+            return text_memory->getChangedContent(startAddr, count);
+        return data_memory->getChangedContent(startAddr, count);
     }
 
     string getPC()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
+        syncState();
 
-        return g_iag->getPC();
+        return iag->getPC();
     }
 
+    // every line still held, see readConsoleSince for polling
     string getConsoleOutput()
     {
-        return consoleOutput;
+        context_scope scope(context);
+        return ctx->console.read_all();
+    }
+
+    // The console lines after cursor (0 for the first call, then the cursor of the previous
+    // chunk) and how many of them were lost to the ring before they could be read
+    ConsoleChunk readConsoleSince(double cursor)
+    {
+        context_scope scope(context);
+        uint64_t dropped;
+        ConsoleChunk chunk;
+        chunk.text = ctx->console.read_since(cursor < 0 ? 0 : static_cast<uint64_t>(cursor), dropped);
+        chunk.cursor = static_cast<double>(ctx->console.cursor());
+        chunk.dropped = static_cast<double>(dropped);
+        return chunk;
     }
 
     void clearConsoleOutput()
     {
+        context_scope scope(context);
         clearConsole();
     }
 
     void toggleForwarding(bool enable)
     {
-        forwarding_enable = enable;
+        context_scope scope(context);
+        if (ctx->forwarding_enable != enable)
+            ctx->checkpoints.drop_after(ctx->clock_cycle); // the cycles after this one run differently now
+        ctx->forwarding_enable = enable;
+        reconfigureFastEngine();
     }
 
-    string getPipelineState()
+    // "fast" runs the integer engine, "reference" the original string engine. Both give the same
+    // cycle-by-cycle results, except that the fast engine divides by zero with the RISC-V defined
+    // result where the reference engine traps. The choice applies immediately before the first
+    // cycle, otherwise on reset.
+    void setEngine(const string &mode)
     {
-        if (!initialized)
+        context_scope scope(context);
+        if (mode != "fast" && mode != "reference")
         {
-            throw runtime_error("Simulator not initialized");
+            throw invalid_argument("Unknown engine: " + mode);
         }
+        engine = mode;
 
-        string result = "";
-        int address = hex_to_dec(g_iag->pc);
-        string ins = "";
-        if (address < 268435456)
+        if (initialized && ctx->clock_cycle == 0)
         {
-            ins += (g_text_memory->mem).memory[address];
-            ins += (g_text_memory->mem).memory[address + 1];
-            ins += (g_text_memory->mem).memory[address + 2];
-            ins += (g_text_memory->mem).memory[address + 3];
+            delete fast_engine;
+            fast_engine = nullptr;
+            if (engine == "fast")
+                fast_engine = newFastEngine();
         }
+    }
 
-        // IF stage
-        result += "IF:";
-        result += ins + ",";
-        result += g_iag->pc + ";";
+    string getEngine()
+    {
+        context_scope scope(context);
+        return engine;
+    }
 
-        // ID stage
-        result += "ID:";
-        if (g_buffers->ifid.pc == "ffffffff" || g_buffers->ifid.pc == "")
-            result += ";";
-        else
+    // Branch predictor of the fast engine: "1bit" (the default, a 1 bit history and target per
+    // branch in tables that never fill up, which the reference engine always uses), "bimodal",
+    // "gshare", "tournament" or "tage", see branch_predictors.cpp. The flat ones have tables of
+    // 2^tableBits entries and use historyBits of global history. Applies immediately before the
+    // first cycle, otherwise on reset or resetState.
+    void setBranchPredictor(const string &kind, int tableBits, int historyBits)
+    {
+        context_scope scope(context);
+        predictors::config next = predictor;
+        int k = 0;
+        while (k < predictors::KINDS && kind != predictors::KIND_NAMES[k])
+            k++;
+        if (k == predictors::KINDS)
         {
-            result += g_buffers->ifid.instr + ",";
-            result += g_buffers->ifid.pc + ";";
+            throw invalid_argument("Unknown branch predictor: " + kind);
         }
-
-        // EX stage
-        result += "EX:";
-        if (g_buffers->idex.pc == "ffffffff" || g_buffers->idex.pc == "")
-            result += ";";
-        else
+        if (tableBits < static_cast<int>(predictors::MIN_TABLE_BITS) || tableBits > static_cast<int>(predictors::MAX_TABLE_BITS))
+        {
+            throw invalid_argument("Predictor tables must have 2^" + to_string(predictors::MIN_TABLE_BITS) + " to 2^" +
+                                   to_string(predictors::MAX_TABLE_BITS) + " entries");
+        }
+        if (historyBits < 1 || historyBits > static_cast<int>(predictors::MAX_HISTORY_BITS))
         {
-            result += g_buffers->idex.instr + ",";
-            result += g_buffers->idex.rs1 + ",";
-            result += g_buffers->idex.rs2 + ",";
-            result += g_buffers->idex.imm + ",";
-            result += g_buffers->idex.rd + ";";
+            throw invalid_argument("Predictor history must be 1 to " + to_string(predictors::MAX_HISTORY_BITS) + " bits");
         }
+        next.kind = static_cast<predictors::Kind>(k);
+        next.table_bits = tableBits;
+        next.history_bits = historyBits;
+        predictor = next;
+
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_predictor(predictor);
+    }
+
+    // e.g. "gshare 10 12": kind, table bits and history bits
+    string getBranchPredictor()
+    {
+        context_scope scope(context);
+        return string(predictors::KIND_NAMES[static_cast<int>(predictor.kind)]) + " " + to_string(predictor.table_bits) + " " +
+               to_string(predictor.history_bits);
+    }
 
-        // MEM stage
-        result += "MEM:";
-        if (g_buffers->exmem.pc == "ffffffff" || g_buffers->exmem.pc == "")
-            result += ";";
+    // Branch target buffer of the fast engine's predictor: entries and ways (powers of two,
+    // ways <= entries), the tag bits kept per entry (0 for all of them) and "lru" or "random"
+    // replacement. entries 0, the default, gives the flat predictors a direct-mapped buffer of
+    // their table size and the 1bit predictor its unbounded BTB. A finite BTB adds its hits,
+    // misses and evictions to getStats and getBP. Applies like setBranchPredictor.
+    void setBTB(int entries, int ways, int tagBits, const string &replacement)
+    {
+        context_scope scope(context);
+        predictors::btb_config btb;
+        if (entries < 0 || entries > static_cast<int>(predictors::MAX_BTB_ENTRIES) || (entries & (entries - 1)))
+        {
+            throw invalid_argument("BTB entries must be 0 or a power of two up to " + to_string(predictors::MAX_BTB_ENTRIES));
+        }
+        if (entries && (ways < 1 || ways > entries || ways > static_cast<int>(predictors::MAX_BTB_WAYS) || (ways & (ways - 1))))
+        {
+            throw invalid_argument("BTB ways must be a power of two up to the entries and " + to_string(predictors::MAX_BTB_WAYS));
+        }
+        if (tagBits < 0 || tagBits > 30)
+        {
+            throw invalid_argument("BTB tags must have 0 to 30 bits");
+        }
+        if (replacement == "lru")
+            btb.replacement = predictors::Replacement::Lru;
+        else if (replacement == "random")
+            btb.replacement = predictors::Replacement::Random;
         else
+            throw invalid_argument("Unknown BTB replacement: " + replacement);
+        btb.entries = entries;
+        btb.ways = entries ? ways : 1;
+        btb.tag_bits = tagBits;
+        predictor.btb = btb;
+
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_predictor(predictor);
+    }
+
+    // e.g. "512 4 12 lru": entries, ways, tag bits and replacement
+    string getBTB()
+    {
+        context_scope scope(context);
+        const predictors::btb_config &btb = predictor.btb;
+        return to_string(btb.entries) + " " + to_string(btb.ways) + " " + to_string(btb.tag_bits) + " " +
+               (btb.replacement == predictors::Replacement::Lru ? "lru" : "random");
+    }
+
+    // Entries of the fast engine's return address stack, 0 (the default) for none. With a stack,
+    // calls (jal/jalr writing x1) push their return address at fetch and returns (jalr x0, x1, 0)
+    // are predicted from it, and getStats shows how the returns went. Applies like
+    // setBranchPredictor.
+    void setReturnStack(int depth)
+    {
+        context_scope scope(context);
+        if (depth < 0 || depth > static_cast<int>(predictors::MAX_RAS_DEPTH))
         {
-            result += g_buffers->exmem.instr + ",";
-            result += g_buffers->exmem.instr_type + ",";
-            result += g_buffers->exmem.exe_out + ";";
+            throw invalid_argument("Return address stack must have 0 to " + to_string(predictors::MAX_RAS_DEPTH) + " entries");
         }
+        predictor.ras_depth = depth;
 
-        // WB stage
-        result += "WB:";
-        if (g_buffers->memwb.pc == "ffffffff" || g_buffers->memwb.pc == "")
-            result += ";";
-        else
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_predictor(predictor);
+    }
+
+    int getReturnStack()
+    {
+        context_scope scope(context);
+        return predictor.ras_depth;
+    }
+
+    // Stage where the fast engine resolves branches and jumps: "execute" (the default, as in the
+    // reference engine) or "decode". Resolving in decode halves the cost of a misprediction to
+    // one cycle, but a branch then stalls in decode for an ALU result computed just ahead of it,
+    // and for a load one or two instructions ahead. Applies like setBranchPredictor.
+    void setBranchResolution(const string &stage)
+    {
+        context_scope scope(context);
+        if (stage != "execute" && stage != "decode")
         {
-            result += g_buffers->memwb.instr + ",";
-            result += g_buffers->memwb.rd + ",";
-            result += ry + ";";
+            throw invalid_argument("Unknown branch resolution stage: " + stage);
         }
+        pipeline.branches_in_decode = stage == "decode";
 
-        // IF/ID buffer
-        result += "IF/ID:";
-        if (g_buffers->ifid.pc == "ffffffff" || g_buffers->ifid.pc == "")
-            result += ";";
-        else
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_pipeline(pipeline);
+    }
+
+    string getBranchResolution()
+    {
+        context_scope scope(context);
+        return pipeline.branches_in_decode ? "decode" : "execute";
+    }
+
+    // Fetch queue of the fast engine between IF and ID: depth instructions (0, the default, fetches
+    // straight into F/D as the reference engine does), filled with up to width instructions a
+    // cycle along the predicted path. Fetch keeps going while decode stalls and a misprediction
+    // squashes the queue, so a queue filled faster than decode drains it hides the fetch cycles
+    // lost to setTakenBranchPenalty. With a queue getStats adds its average occupancy, the cycles
+    // it was full, the instructions squashed and the front-end bound cycles, those where decode
+    // got no instruction. Applies like setBranchPredictor.
+    void setFetchQueue(int depth, int width)
+    {
+        context_scope scope(context);
+        if (depth < 0 || depth > static_cast<int>(fast::fetch_queue::MAX_DEPTH))
         {
-            result += g_buffers->ifid.instr + ",";
-            result += g_buffers->ifid.pc + ";";
+            throw invalid_argument("Fetch queue must have 0 to " + to_string(fast::fetch_queue::MAX_DEPTH) + " entries");
         }
+        if (width < 1 || width > static_cast<int>(fast::pipeline_config::MAX_FETCH_WIDTH))
+        {
+            throw invalid_argument("Fetch width must be 1 to " + to_string(fast::pipeline_config::MAX_FETCH_WIDTH));
+        }
+        pipeline.queue_depth = depth;
+        pipeline.fetch_width = width;
 
-        // ID/EX buffer
-        result += "ID/EX:";
-        if (g_buffers->idex.pc == "ffffffff" || g_buffers->idex.pc == "")
-            result += ";";
-        else
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_pipeline(pipeline);
+    }
+
+    // e.g. "8 2": depth and width
+    string getFetchQueue()
+    {
+        context_scope scope(context);
+        return to_string(pipeline.queue_depth) + " " + to_string(pipeline.fetch_width);
+    }
+
+    // Cycles the fast engine's fetch loses after each branch or jump predicted taken, before the
+    // target's instructions arrive: 0 (the default) redirects at once as the reference engine
+    // does. Without a fetch queue each such cycle is a bubble in decode. getStats adds the cycles
+    // fetch waited and the front-end bound cycles. Applies like setBranchPredictor.
+    void setTakenBranchPenalty(int cycles)
+    {
+        context_scope scope(context);
+        if (cycles < 0 || cycles > static_cast<int>(fast::pipeline_config::MAX_TAKEN_PENALTY))
         {
-            result += g_buffers->idex.instr + ",";
-            result += g_buffers->idex.rs1 + ",";
-            result += g_buffers->idex.rs2 + ",";
-            result += g_buffers->idex.imm + ",";
-            result += g_buffers->idex.rd + ";";
+            throw invalid_argument("Taken branch penalty must be 0 to " + to_string(fast::pipeline_config::MAX_TAKEN_PENALTY) + " cycles");
         }
+        pipeline.taken_penalty = cycles;
+
+        if (initialized && ctx->clock_cycle == 0 && fast_engine)
+            fast_engine->configure_pipeline(pipeline);
+    }
+
+    int getTakenBranchPenalty()
+    {
+        context_scope scope(context);
+        return pipeline.taken_penalty;
+    }
 
-        // EX/MEM buffer
-        result += "EX/MEM:";
-        if (g_buffers->exmem.pc == "ffffffff" || g_buffers->exmem.pc == "")
-            result += ";";
+    // "off", "summary", "hazards" or "full" (the default), see TraceLevel. Takes effect from the next cycle.
+    void setTraceLevel(const string &level)
+    {
+        context_scope scope(context);
+        if (level == "off")
+            ctx->trace = TraceLevel::Off;
+        else if (level == "summary")
+            ctx->trace = TraceLevel::Summary;
+        else if (level == "hazards")
+            ctx->trace = TraceLevel::Hazards;
+        else if (level == "full")
+            ctx->trace = TraceLevel::Full;
         else
+            throw invalid_argument("Unknown trace level: " + level);
+        reconfigureFastEngine();
+    }
+
+    string getTraceLevel()
+    {
+        context_scope scope(context);
+        static const char *const names[] = {"off", "summary", "hazards", "full"};
+        return names[static_cast<int>(ctx->trace)];
+    }
+
+    // Breakpoints and watchpoints stop step, run and the bounded runs after the cycle in which
+    // they hit: a breakpoint when the instruction at its pc is fetched, a register watch when
+    // the register is written with a value meeting the condition, a memory watch when a store
+    // touches its range. fastForward does not check them. Each add returns an id for removeWatch;
+    // they are kept across init and reset.
+    int addBreakpoint(int pc)
+    {
+        context_scope scope(context);
+        return ctx->watch.add_breakpoint(static_cast<uint32_t>(pc));
+    }
+
+    // e.g. addRegisterWatch(10, "==", 5); op is ==, !=, <, <=, > or >=, compared as signed
+    int addRegisterWatch(int reg, const string &op, int value)
+    {
+        context_scope scope(context);
+        Watchpoints::Cmp cmp;
+        if (reg < 1 || reg > 31)
+            throw invalid_argument("Invalid register for watch: " + to_string(reg));
+        if (!Watchpoints::parse_cmp(op, cmp))
+            throw invalid_argument("Unknown comparison: " + op);
+        return ctx->watch.add_condition(static_cast<uint8_t>(reg), cmp, value);
+    }
+
+    int addMemoryWatch(int address, int size)
+    {
+        context_scope scope(context);
+        if (size <= 0)
+            throw invalid_argument("Watched range must not be empty");
+        return ctx->watch.add_range(static_cast<uint32_t>(address), static_cast<uint32_t>(size));
+    }
+
+    bool removeWatch(int id)
+    {
+        context_scope scope(context);
+        return ctx->watch.remove(id);
+    }
+
+    void clearWatches()
+    {
+        context_scope scope(context);
+        ctx->watch.clear();
+    }
+
+    // Moves to the state after the given cycle: back by restoring the nearest earlier checkpoint
+    // and replaying from it, forward by running. Replayed cycles print nothing and ignore
+    // breakpoints. Returns the cycle reached, which is earlier when the program ends first.
+    // Needs the fast engine.
+    int seekToCycle(int cycle)
+    {
+        context_scope scope(context);
+        generation++;
+        if (!initialized)
         {
-            result += g_buffers->exmem.instr + ",";
-            result += g_buffers->exmem.instr_type + ",";
-            result += g_buffers->exmem.exe_out + ";";
+            throw runtime_error("Simulator not initialized");
         }
 
-        // MEM/WB buffer
-        result += "MEM/WB:";
-        if (g_buffers->memwb.pc == "ffffffff" || g_buffers->memwb.pc == "")
-            result += ";";
-        else
+        if (!fast_engine)
         {
-            result += g_buffers->memwb.instr + ",";
-            result += g_buffers->memwb.rd + ",";
-            result += ry + ";";
+            throw runtime_error("Seeking needs the fast engine");
         }
-        // Forwarding paths
-        result += "FWD:";
-        for (const auto &path : forwardingPaths)
+
+        if (cycle < 0)
         {
-            result += path.first + "-" + path.second + ",";
+            throw invalid_argument("Cannot seek to cycle " + to_string(cycle));
         }
-        result += ";";
 
-        // Hazards
-        result += "HAZ:";
-        for (const auto &hazard : hazards)
+        uint64_t target = cycle;
+        if (target < static_cast<uint64_t>(ctx->clock_cycle))
         {
-            for (const auto &entry : hazard)
+            auto it = ctx->checkpoints.saved.upper_bound(target);
+            if (it == ctx->checkpoints.saved.begin())
+            {
+                throw runtime_error("No checkpoint at or before cycle " + to_string(cycle));
+            }
+            --it;
+            if (!fast_engine->restore(*it->second))
             {
-                result += entry + ",";
+                throw runtime_error("The checkpoint was taken with another branch predictor");
             }
-            result += "-";
+            ctx->history.rewind(it->first);
+            ctx->checkpoints.schedule(it->first);
+            running = true;
         }
+        if (running)
+            replay(target);
+        return static_cast<int>(ctx->clock_cycle);
+    }
 
-        return result;
+    // Undoes the last cycle; false at cycle 0
+    bool stepBack()
+    {
+        context_scope scope(context);
+        if (!initialized || ctx->clock_cycle == 0)
+            return false;
+        seekToCycle(static_cast<int>(ctx->clock_cycle - 1));
+        return true;
+    }
+
+    // Cycles between checkpoints, 1000 by default; 0 stops taking them and drops those held.
+    // The interval doubles whenever too many are held, see CheckpointLog.
+    void setCheckpointInterval(int cycles)
+    {
+        context_scope scope(context);
+        ctx->checkpoints.interval = cycles > 0 ? cycles : 0;
+        if (!ctx->checkpoints.interval)
+            ctx->checkpoints.saved.clear();
+        ctx->checkpoints.schedule(ctx->clock_cycle);
+    }
+
+    // what stopped the last step or run, empty when nothing was hit
+    string getStopReason()
+    {
+        context_scope scope(context);
+        return ctx->watch.reason;
+    }
+
+    string getPipelineState()
+    {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        HistoryEntry entry;
+        if (fast_engine)
+            fast_engine->record_history(entry);
+        else
+            control->record_history(entry);
+        return formatPipelineState(entry);
+    }
+
+    // Keeps the pipeline state of the last `cycles` cycles for getPipelineStateAt, 0 turns the
+    // history off. The history restarts empty.
+    void setHistoryCapacity(int cycles)
+    {
+        context_scope scope(context);
+        ctx->history.set_capacity(cycles > 0 ? cycles : 0);
+    }
+
+    // getPipelineState as it was after the given cycle (the cycle count of getStats), for the
+    // cycles from getHistoryStart() up to the current one
+    string getPipelineStateAt(int cycle)
+    {
+        context_scope scope(context);
+        const HistoryEntry *entry = cycle < 0 ? nullptr : ctx->history.at(cycle);
+        if (!entry)
+        {
+            throw out_of_range("Cycle " + to_string(cycle) + " is not in the history");
+        }
+        return formatPipelineState(*entry);
+    }
+
+    // Oldest cycle held, -1 while the history is empty
+    int getHistoryStart()
+    {
+        context_scope scope(context);
+        return ctx->history.empty() ? -1 : static_cast<int>(ctx->history.oldest());
     }
 
     string getBP()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
+        syncState();
 
         string result = "";
-        for (const auto &entry : g_brpre->BTB)
+        for (const auto &entry : brpre->BTB)
         {
-            result += entry.first + ":" + entry.second + "," + (g_brpre->BHT[entry.first] ? "true" : "false") + ";";
+            result += entry.first + ":" + entry.second + "," + (brpre->BHT[entry.first] ? "true" : "false") + ";";
         }
+        // the counters of a finite BTB, without a ':' so it does not parse as an entry
+        if (const predictors::btb_counters *btb = btbCounters())
+            result += "BTB hits=" + to_string(btb->hits) + ",misses=" + to_string(btb->misses) + ",evictions=" + to_string(btb->evictions) + ";";
         return result;
     }
 
     string getBuffers()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
+        syncState();
 
         string result = "";
-        result += "IFID: " + g_buffers->ifid.instr + "," + g_buffers->ifid.pc + ";";
-        result += "IDEX: " + g_buffers->idex.instr + "," + g_buffers->idex.rs1 + "," + g_buffers->idex.rs2 + "," + g_buffers->idex.rd + "," + g_buffers->idex.imm + ";";
-        result += "EXMEM: " + g_buffers->exmem.instr + "," + g_buffers->exmem.exe_out + "," + g_buffers->exmem.rs2val + "," + g_buffers->exmem.rd + ";";
-        result += "MEMWB: " + g_buffers->memwb.instr + "," + g_buffers->memwb.exe_out + "," + g_buffers->memwb.rs2val + "," + g_buffers->memwb.rd + ";";
+        result += "IFID: " + latches->ifid.instr + "," + latches->ifid.pc + ";";
+        result += "IDEX: " + latches->idex.instr + "," + latches->idex.rs1 + "," + latches->idex.rs2 + "," + latches->idex.rd + "," + latches->idex.imm + ";";
+        result += "EXMEM: " + latches->exmem.instr + "," + latches->exmem.exe_out + "," + latches->exmem.rs2val + "," + latches->exmem.rd + ";";
+        result += "MEMWB: " + latches->memwb.instr + "," + latches->memwb.exe_out + "," + latches->memwb.rs2val + "," + latches->memwb.rd + ";";
         return result;
     }
 
     string getStats()
     {
-        if (instructionCt > 0)
-            CPI = clock_cycle / instructionCt;
+        context_scope scope(context);
+        if (ctx->instructionCt > 0)
+            ctx->CPI = ctx->clock_cycle / ctx->instructionCt;
         string result = "";
-        result += "Cycle count:" + to_string(clock_cycle) + ";";
-        result += "Instruction count:" + to_string(instructionCt) + ";";
-        result += "CPI:" + to_string(CPI) + ";";
-        result += "Data Transfer Instructions:" + to_string(DataTransferInstr) + ";";
-        result += "ALU Instructions:" + to_string(ALUInstr) + ";";
-        result += "Control Instructions:" + to_string(ControlInstr) + ";";
-        result += "Stall Count:" + to_string(stalls) + ";";
-        result += "Data Hazards:" + to_string(data_hazards) + ";";
-        result += "Control Hazards:" + to_string(control_hazards) + ";";
-        result += "Branch Mispredictions:" + to_string(mispredictions) + ";";
-        result += "Data Hazard Stalls:" + to_string(data_stalls) + ";";
-        result += "Control Hazard Stalls:" + to_string(control_stalls) + ";";
+        result += "Cycle count:" + to_string(ctx->clock_cycle) + ";";
+        result += "Instruction count:" + to_string(ctx->instructionCt) + ";";
+        result += "CPI:" + to_string(ctx->CPI) + ";";
+        result += "Data Transfer Instructions:" + to_string(ctx->DataTransferInstr) + ";";
+        result += "ALU Instructions:" + to_string(ctx->ALUInstr) + ";";
+        result += "Control Instructions:" + to_string(ctx->ControlInstr) + ";";
+        result += "Stall Count:" + to_string(ctx->stalls) + ";";
+        result += "Data Hazards:" + to_string(ctx->data_hazards) + ";";
+        result += "Control Hazards:" + to_string(ctx->control_hazards) + ";";
+        result += "Branch Mispredictions:" + to_string(ctx->mispredictions) + ";";
+        result += "Data Hazard Stalls:" + to_string(ctx->data_stalls) + ";";
+        result += "Control Hazard Stalls:" + to_string(ctx->control_stalls) + ";";
+        if (const predictors::btb_counters *btb = btbCounters())
+        {
+            result += "BTB Hits:" + to_string(btb->hits) + ";";
+            result += "BTB Misses:" + to_string(btb->misses) + ";";
+            result += "BTB Evictions:" + to_string(btb->evictions) + ";";
+        }
+        if (const predictors::ras_counters *ras = rasCounters())
+        {
+            result += "RAS Calls:" + to_string(ras->calls) + ";";
+            result += "RAS Returns:" + to_string(ras->returns) + ";";
+            result += "RAS Correct:" + to_string(ras->correct) + ";";
+            result += "RAS Mispredicted:" + to_string(ras->incorrect) + ";";
+            result += "RAS Overflows:" + to_string(ras->overflows) + ";";
+            result += "RAS Underflows:" + to_string(ras->underflows) + ";";
+        }
+        if (const fast::fetch_queue_counters *fq = fetchCounters())
+        {
+            if (pipeline.queue_depth)
+            {
+                double occupancy = fq->cycles ? static_cast<double>(fq->occupancy) / fq->cycles : 0;
+                result += "Fetch Queue Occupancy:" + to_string(occupancy) + ";";
+                result += "Fetch Queue Full Cycles:" + to_string(fq->full) + ";";
+                result += "Fetch Queue Squashed:" + to_string(fq->squashed) + ";";
+            }
+            if (pipeline.taken_penalty)
+                result += "Fetch Redirect Cycles:" + to_string(fq->redirects) + ";";
+            result += "Front-End Bound Cycles:" + to_string(fq->front_end_bound) + ";";
+        }
         return result;
     }
 
     void setPrintPipelineForInstruction(const string &pc)
     {
-        printPipelineForInstruction = pc;
+        context_scope scope(context);
+        ctx->printPipelineForInstruction = pc;
+        reconfigureFastEngine();
     }
 
 private:
     bool initialized;
+    string engine;
+
+    SimContext context;
+    PMI_data *data_memory = nullptr;
+    PMI_text *text_memory = nullptr;
+    IAG *iag = nullptr;
+    RegisterFile *registers = nullptr;
+    ALU *alu = nullptr;
+    buffers *latches = nullptr;
+    BranchPredictor *brpre = nullptr;
+    control_circuitry *control = nullptr;
+    fast::engine *fast_engine = nullptr; // integer engine, null when the string engine runs
+    predictors::config predictor; // of the fast engine, see setBranchPredictor
+    fast::pipeline_config pipeline; // of the fast engine, see setBranchResolution
+    bool running = true;
+    PagedMemory loaded_data; // the data segment as loadCode left it, for resetState
+    bool program_loaded = false;
+
+    // (Re)creates the processor parts of the string engine; the memories are kept
+    void newProcessor()
+    {
+        delete iag;
+        delete registers;
+        delete alu;
+        delete latches;
+        delete brpre;
+        delete control;
+        iag = new IAG();
+        registers = new RegisterFile();
+        alu = new ALU();
+        latches = new buffers();
+        brpre = new BranchPredictor();
+        control = new control_circuitry(*data_memory, *text_memory, *iag, *registers, *alu, *latches, *brpre);
+    }
+
+    // Statistics, datapath and the per-cycle logs back to before the first cycle
+    void restart()
+    {
+        running = true;
+        ctx->clock_cycle = 0;
+        ctx->instructionCt = 0;
+        ctx->CPI = 0;
+        ctx->DataTransferInstr = 0;
+        ctx->ALUInstr = 0;
+        ctx->ControlInstr = 0;
+        ctx->stalls = 0;
+        ctx->data_hazards = 0;
+        ctx->control_hazards = 0;
+        ctx->mispredictions = 0;
+        ctx->data_stalls = 0;
+        ctx->control_stalls = 0;
+        ctx->rz = ctx->ry = ctx->ra = ctx->rb = "";
+        ctx->dp = decltype(SimContext::dp)();
+        ctx->forwardingPaths.clear();
+        ctx->hazards.clear();
+        ctx->history.clear();
+        ctx->checkpoints.reset(0);
+    }
+
+    fast::engine *newFastEngine()
+    {
+        bool forwarding = ctx->forwarding_enable, spotlight = !ctx->printPipelineForInstruction.empty();
+        fast::engine *built = fast::instantiate<fast::BranchPredictor>(forwarding, spotlight, ctx->trace, *data_memory, *text_memory);
+        built->configure_predictor(predictor);
+        built->configure_pipeline(pipeline);
+        return built;
+    }
+
+    const predictors::btb_counters *btbCounters()
+    {
+        return initialized && fast_engine ? fast_engine->btb_counters() : nullptr;
+    }
+
+    const predictors::ras_counters *rasCounters()
+    {
+        return initialized && fast_engine ? fast_engine->ras_counters() : nullptr;
+    }
+
+    const fast::fetch_queue_counters *fetchCounters()
+    {
+        return initialized && fast_engine ? fast_engine->fetch_counters() : nullptr;
+    }
+
+    // Swaps in the instantiation for the current forwarding, spotlight and trace settings
+    void reconfigureFastEngine()
+    {
+        if (!fast_engine)
+            return;
+        fast::engine *next = fast_engine->reconfigure(ctx->forwarding_enable, !ctx->printPipelineForInstruction.empty(), ctx->trace);
+        if (next != fast_engine)
+        {
+            delete fast_engine;
+            fast_engine = next;
+        }
+    }
+
+    RunResult runBounded(const RunLimits &limits)
+    {
+        generation++;
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        RunResult result = {"halted", 0};
+        if (!running)
+        {
+            appendToConsole("=> Simulation has ended");
+            return result;
+        }
+
+        uint64_t cycles = 0;
+        RunStatus status;
+        ctx->watch.reset_hit();
+        if (fast_engine)
+            status = fast_engine->run(limits, cycles);
+        else
+        {
+            auto step_one = [this]()
+            {
+                return control->step();
+            };
+            auto fetched = [this]()
+            {
+                const string &pc = latches->ifid.pc;
+                return pc.empty() ? fast::NO_PC : static_cast<uint32_t>(stoul(pc, nullptr, 16));
+            };
+            status = run_bounded(limits, cycles, step_one, fetched);
+        }
+
+        static const char *names[] = {"halted", "cycles", "pc", "time", "watch"};
+        result.status = names[static_cast<int>(status)];
+        result.cycles = static_cast<int>(cycles);
+        if (status == RunStatus::Halted)
+            running = false;
+        reportWatch();
+        return result;
+    }
+
+    // Steps silently up to cycle target or the end of the program
+    void replay(uint64_t target)
+    {
+        TraceLevel trace = ctx->trace;
+        bool armed = ctx->watch.armed;
+        ctx->trace = TraceLevel::Off;
+        ctx->watch.armed = false;
+        reconfigureFastEngine();
+        try
+        {
+            while (static_cast<uint64_t>(ctx->clock_cycle) < target)
+                if (!fast_engine->step())
+                {
+                    running = false;
+                    break;
+                }
+        }
+        catch (...)
+        {
+            ctx->trace = trace;
+            ctx->watch.armed = armed;
+            reconfigureFastEngine();
+            throw;
+        }
+        ctx->trace = trace;
+        ctx->watch.armed = armed;
+        reconfigureFastEngine();
+    }
+
+    void reportWatch()
+    {
+        if (ctx->watch.hit)
+            appendToConsole("=> Stopped by " + ctx->watch.reason);
+    }
+
+    StateBlock state_block = {};
+    StepDelta delta;
+    vector<uint32_t> delta_words;
+    vector<PredictorEntry> predictor_entries;
+    uint32_t generation = 0; // bumped by every call that can change the simulator state
+
+    void fillStateBlock()
+    {
+        StateBlock &block = state_block;
+        block.layout = STATE_LAYOUT;
+        block.generation = generation;
+        block.running = running;
+        if (fast_engine)
+            fast_engine->export_block(block, predictor_entries);
+        else
+            fillFromStrings(block);
+
+        block.cycles = static_cast<uint32_t>(ctx->clock_cycle);
+        block.instructions = static_cast<uint32_t>(ctx->instructionCt);
+        block.data_transfer = static_cast<uint32_t>(ctx->DataTransferInstr);
+        block.alu = static_cast<uint32_t>(ctx->ALUInstr);
+        block.control = static_cast<uint32_t>(ctx->ControlInstr);
+        block.stalls = static_cast<uint32_t>(ctx->stalls);
+        block.data_hazards = static_cast<uint32_t>(ctx->data_hazards);
+        block.control_hazards = static_cast<uint32_t>(ctx->control_hazards);
+        block.mispredictions = static_cast<uint32_t>(ctx->mispredictions);
+        block.data_stalls = static_cast<uint32_t>(ctx->data_stalls);
+        block.control_stalls = static_cast<uint32_t>(ctx->control_stalls);
+        block.predictor_entries = static_cast<uint32_t>(predictor_entries.size());
+    }
+
+    static uint32_t parse_word(const string &s, int base = 16)
+    {
+        return s.empty() ? 0 : static_cast<uint32_t>(stoul(s, nullptr, base));
+    }
+
+    static bool is_bubble(const string &pc)
+    {
+        return pc.empty() || pc == "ffffffff";
+    }
+
+    template <typename Latch>
+    static void string_latch(LatchState &state, const Latch &latch)
+    {
+        state = LatchState();
+        state.pc = state.next_pc = fast::NO_PC;
+        if (is_bubble(latch.pc))
+            return;
+        state.pc = parse_word(latch.pc);
+        state.next_pc = parse_word(latch.next_pc);
+        state.instr = parse_word(latch.instr);
+        state.imm = parse_word(latch.imm);
+        state.rs1val = parse_word(latch.rs1val);
+        state.rs2val = parse_word(latch.rs2val);
+        state.opcode = parse_word(latch.opcode, 2);
+        state.rd = parse_word(latch.rd, 2);
+        state.rs1 = parse_word(latch.rs1, 2);
+        state.rs2 = parse_word(latch.rs2, 2);
+        state.funct3 = parse_word(latch.funct3, 2);
+        state.funct7 = parse_word(latch.funct7, 2);
+        for (int op = 0; op <= static_cast<int>(isa::Op::Unknown); op++)
+            if (latch.instr_type == isa::op_name(static_cast<isa::Op>(op)))
+                state.instr_type = op;
+        if (!latch.rs1val.empty())
+            state.flags |= LATCH_OPERANDS;
+        if (latch.wb_needed)
+            state.flags |= LATCH_WB;
+    }
+
+    // The reference engine's equivalent of fast::engine::export_block
+    void fillFromStrings(StateBlock &block)
+    {
+        block.pc = parse_word(iag->pc);
+        for (int i = 0; i < 32; i++)
+            block.regs[i] = parse_word(registers->regs[i]);
+
+        block.ifid = LatchState();
+        block.ifid.pc = block.ifid.next_pc = fast::NO_PC;
+        if (!is_bubble(latches->ifid.pc))
+        {
+            block.ifid.pc = parse_word(latches->ifid.pc);
+            block.ifid.next_pc = parse_word(latches->ifid.next_pc);
+            block.ifid.instr = parse_word(latches->ifid.instr);
+        }
+
+        const IDEX_buffer &idex = latches->idex;
+        string_latch(block.idex, idex);
+        if (!is_bubble(idex.pc))
+            block.idex.flags |= (idex.mem_store_needed ? LATCH_MEM_STORE : 0) | (idex.mem_load_needed ? LATCH_MEM_LOAD : 0) |
+                                (idex.branch_needed ? LATCH_BRANCH : 0) | (idex.jal ? LATCH_JAL : 0) | (idex.jalr ? LATCH_JALR : 0);
+
+        const EXMEM_buffer &exmem = latches->exmem;
+        string_latch(block.exmem, exmem);
+        if (!is_bubble(exmem.pc))
+        {
+            block.exmem.exe_out = parse_word(exmem.exe_out);
+            block.exmem.flags |= (exmem.exe_out.empty() ? 0 : LATCH_EXE_OUT) | (exmem.mem_store_needed ? LATCH_MEM_STORE : 0) |
+                                 (exmem.mem_load_needed ? LATCH_MEM_LOAD : 0);
+        }
+
+        const MEMWB_buffer &memwb = latches->memwb;
+        string_latch(block.memwb, memwb);
+        if (!is_bubble(memwb.pc))
+        {
+            block.memwb.exe_out = parse_word(memwb.exe_out);
+            block.memwb.flags |= memwb.exe_out.empty() ? 0 : LATCH_EXE_OUT;
+        }
+
+        block.ry = parse_word(ctx->ry);
+        block.ry_set = !ctx->ry.empty();
+
+        predictor_entries.clear();
+        for (const auto &entry : brpre->BHT)
+        {
+            auto target = brpre->BTB.find(entry.first);
+            predictor_entries.push_back({parse_word(entry.first), target == brpre->BTB.end() ? 0 : parse_word(target->second), entry.second});
+        }
+        sort(predictor_entries.begin(), predictor_entries.end(), [](const PredictorEntry &a, const PredictorEntry &b)
+             { return a.pc < b.pc; });
+    }
+
+    // A HistoryEntry in getPipelineState's format: IF, ID, EX, MEM and WB, then the four latches,
+    // forwarding paths and hazards
+    string formatPipelineState(const HistoryEntry &entry)
+    {
+        using fast::hex32;
+        using fast::bits;
+        string result = "";
+        int address = static_cast<int>(entry.pc);
+        string ins = "";
+        if (address < 268435456)
+        {
+            ins = text_memory->mem.memory.hex(address, 4);
+        }
+
+        string ifid = entry.flags & HistoryEntry::IFID_BUBBLE ? ";" : hex32(entry.ifid_instr) + "," + hex32(entry.ifid_pc) + ";";
+        string idex = entry.flags & HistoryEntry::IDEX_BUBBLE ? ";"
+                                                              : hex32(entry.idex_instr) + "," + bits(entry.idex_regs & 31, 5) + "," +
+                                                                    bits(entry.idex_regs >> 5 & 31, 5) + "," + fast::imm_str(entry.idex_imm) + "," +
+                                                                    bits(entry.idex_regs >> 10 & 31, 5) + ";";
+        string exmem = entry.flags & HistoryEntry::EXMEM_BUBBLE ? ";"
+                                                                : hex32(entry.exmem_instr) + "," + isa::op_name(static_cast<isa::Op>(entry.exmem_type)) + "," +
+                                                                      (entry.flags & HistoryEntry::OUT_SET ? hex32(entry.exmem_out) : "") + ";";
+        string memwb = entry.flags & HistoryEntry::MEMWB_BUBBLE ? ";"
+                                                                : hex32(entry.memwb_instr) + "," + bits(entry.memwb_rd, 5) + "," +
+                                                                      (entry.flags & HistoryEntry::RY_SET ? hex32(entry.ry) : "") + ";";
+
+        // each stage shows the latch it reads
+        result += "IF:" + ins + "," + hex32(entry.pc) + ";";
+        result += "ID:" + ifid;
+        result += "EX:" + idex;
+        result += "MEM:" + exmem;
+        result += "WB:" + memwb;
+        result += "IF/ID:" + ifid;
+        result += "ID/EX:" + idex;
+        result += "EX/MEM:" + exmem;
+        result += "MEM/WB:" + memwb;
+
+        result += "FWD:";
+        for (int i = 0; i < (entry.paths & 7); i++)
+            result += entry.paths >> (3 + i) & 1 ? "MEM/WB-ID/EX," : "EX/MEM-ID/EX,";
+        result += ";";
+
+        result += "HAZ:";
+        for (int i = 0; i < (entry.hazards & 3); i++)
+        {
+            string words[2];
+            for (int w = 0; w < 2; w++)
+            {
+                int form = entry.hazard_forms >> (4 * i + 2 * w) & 3;
+                words[w] = form == HistoryEntry::WORD_EMPTY ? "" : form == HistoryEntry::WORD_NO_PC ? "ffffffff" : hex32(entry.hazard_words[i][w]);
+            }
+            int kind = entry.hazards >> (2 + 2 * i) & 3;
+            if (kind == 0)
+                result += "Control," + words[0] + "," + words[1] + ",-";
+            else
+                result += "Data,ID/EX," + words[0] + (kind == 1 ? ",EX/MEM," : ",MEM/WB,") + words[1] + ",-";
+        }
+        return result;
+    }
+
+    // The integer engine keeps no strings, so refresh the string structures the readers format
+    void syncState()
+    {
+        if (fast_engine)
+            fast_engine->export_state(*iag, *registers, *latches, *brpre);
+    }
 };
 
 // Binding our C++ class to JavaScript
@@ -1930,6 +5232,15 @@ EMSCRIPTEN_BINDINGS(riscv_pipelined_simulator)
 {
     using namespace emscripten;
 
+    value_object<RunResult>("RunResult")
+        .field("status", &RunResult::status)
+        .field("cycles", &RunResult::cycles);
+
+    value_object<ConsoleChunk>("ConsoleChunk")
+        .field("text", &ConsoleChunk::text)
+        .field("cursor", &ConsoleChunk::cursor)
+        .field("dropped", &ConsoleChunk::dropped);
+
     class_<RiscVPipelinedSimulator>("RiscVPipelinedSimulator")
         .constructor<>()
         .function("init", &RiscVPipelinedSimulator::init)
@@ -1937,11 +5248,18 @@ EMSCRIPTEN_BINDINGS(riscv_pipelined_simulator)
         .function("loadCode", &RiscVPipelinedSimulator::loadCode)
         .function("step", &RiscVPipelinedSimulator::step)
         .function("run", &RiscVPipelinedSimulator::run)
+        .function("runCycles", &RiscVPipelinedSimulator::runCycles)
+        .function("runUntilPC", &RiscVPipelinedSimulator::runUntilPC)
+        .function("runForMillis", &RiscVPipelinedSimulator::runForMillis)
+        .function("fastForward", &RiscVPipelinedSimulator::fastForward)
         .function("reset", &RiscVPipelinedSimulator::reset)
+        .function("resetState", &RiscVPipelinedSimulator::resetState)
         .function("showReg", &RiscVPipelinedSimulator::showReg)
         .function("showMem", &RiscVPipelinedSimulator::showMem)
+        .function("showMemChanges", &RiscVPipelinedSimulator::showMemChanges)
         .function("getPC", &RiscVPipelinedSimulator::getPC)
         .function("getConsoleOutput", &RiscVPipelinedSimulator::getConsoleOutput)
+        .function("readConsoleSince", &RiscVPipelinedSimulator::readConsoleSince)
         .function("clearConsoleOutput", &RiscVPipelinedSimulator::clearConsoleOutput)
         .function("getStats", &RiscVPipelinedSimulator::getStats)
         .function("setForwardingEnable", &RiscVPipelinedSimulator::toggleForwarding)
@@ -1949,8 +5267,39 @@ EMSCRIPTEN_BINDINGS(riscv_pipelined_simulator)
         .function("getBP", &RiscVPipelinedSimulator::getBP)
         .function("toggleForwarding", &RiscVPipelinedSimulator::toggleForwarding)
         .function("getPipelineState", &RiscVPipelinedSimulator::getPipelineState)
+        .function("setHistoryCapacity", &RiscVPipelinedSimulator::setHistoryCapacity)
+        .function("getPipelineStateAt", &RiscVPipelinedSimulator::getPipelineStateAt)
+        .function("getHistoryStart", &RiscVPipelinedSimulator::getHistoryStart)
         .function("setPrintPipelineForInstruction", &RiscVPipelinedSimulator::setPrintPipelineForInstruction)
-        .function("getBuffers", &RiscVPipelinedSimulator::getBuffers);
+        .function("setEngine", &RiscVPipelinedSimulator::setEngine)
+        .function("getEngine", &RiscVPipelinedSimulator::getEngine)
+        .function("setBranchPredictor", &RiscVPipelinedSimulator::setBranchPredictor)
+        .function("getBranchPredictor", &RiscVPipelinedSimulator::getBranchPredictor)
+        .function("setBTB", &RiscVPipelinedSimulator::setBTB)
+        .function("getBTB", &RiscVPipelinedSimulator::getBTB)
+        .function("setReturnStack", &RiscVPipelinedSimulator::setReturnStack)
+        .function("getReturnStack", &RiscVPipelinedSimulator::getReturnStack)
+        .function("setBranchResolution", &RiscVPipelinedSimulator::setBranchResolution)
+        .function("getBranchResolution", &RiscVPipelinedSimulator::getBranchResolution)
+        .function("setFetchQueue", &RiscVPipelinedSimulator::setFetchQueue)
+        .function("getFetchQueue", &RiscVPipelinedSimulator::getFetchQueue)
+        .function("setTakenBranchPenalty", &RiscVPipelinedSimulator::setTakenBranchPenalty)
+        .function("getTakenBranchPenalty", &RiscVPipelinedSimulator::getTakenBranchPenalty)
+        .function("setTraceLevel", &RiscVPipelinedSimulator::setTraceLevel)
+        .function("getTraceLevel", &RiscVPipelinedSimulator::getTraceLevel)
+        .function("addBreakpoint", &RiscVPipelinedSimulator::addBreakpoint)
+        .function("addRegisterWatch", &RiscVPipelinedSimulator::addRegisterWatch)
+        .function("addMemoryWatch", &RiscVPipelinedSimulator::addMemoryWatch)
+        .function("removeWatch", &RiscVPipelinedSimulator::removeWatch)
+        .function("clearWatches", &RiscVPipelinedSimulator::clearWatches)
+        .function("getStopReason", &RiscVPipelinedSimulator::getStopReason)
+        .function("seekToCycle", &RiscVPipelinedSimulator::seekToCycle)
+        .function("stepBack", &RiscVPipelinedSimulator::stepBack)
+        .function("setCheckpointInterval", &RiscVPipelinedSimulator::setCheckpointInterval)
+        .function("getBuffers", &RiscVPipelinedSimulator::getBuffers)
+        .function("stepWithDelta", &RiscVPipelinedSimulator::stepWithDelta)
+        .function("getStateView", &RiscVPipelinedSimulator::getStateView)
+        .function("getPredictorView", &RiscVPipelinedSimulator::getPredictorView);
 };
 
 // int main()
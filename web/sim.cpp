@@ -1,4 +1,8 @@
 #include<bits/stdc++.h>
+#include "paged_memory.cpp"
+#include "isa.cpp"
+#include "block_cache.cpp"
+#include "jit_x86.cpp"
 using namespace std;
 
 //global controls
@@ -969,8 +973,86 @@ public:
     }
 };
 
+// Functional mode: runs the program without the pipeline or any per-cycle output, for long
+// programs that only need their final state. Text and data are copied into paged memories, run
+// by jit::engine (hot blocks translated to x86-64 where available) and written back so the
+// usual dumps apply. Loads and stores keep PMI_data's checks and messages.
+struct functional_memory
+{
+    PagedMemory data;
+    string error;
+};
+
+bool functional_access(jit::state &s, uint32_t funct3, uint32_t address, int &size)
+{
+    functional_memory &mem = *static_cast<functional_memory *>(s.host);
+    if (static_cast<int32_t>(address) < 268435456) mem.error = "This is data memory only and cannot access the text segment.\n";
+    else if (funct3 == 3) mem.error = "Loading double is not possible in a 32 bit register.\n";
+    else
+    {
+        size = funct3 == 0 ? 1 : funct3 == 1 ? 2 : 4;
+        return true;
+    }
+    s.fault = 1;
+    return false;
+}
+
+uint32_t functional_load(jit::state &s, uint32_t funct3, uint32_t address)
+{
+    int size;
+    uint32_t value = 0;
+    if (functional_access(s, funct3, address, size))
+        static_cast<functional_memory *>(s.host)->data.read(address, size, value);
+    return value;
+}
+
+void functional_store(jit::state &s, uint32_t funct3, uint32_t address, uint32_t value)
+{
+    int size;
+    if (functional_access(s, funct3, address, size))
+        static_cast<functional_memory *>(s.host)->data.write(address, value, size);
+}
 
-int main()
+void run_functional(PMI_text &text_memory, PMI_data &data_memory, IAG &iag, RegisterFile &registers, bool use_jit)
+{
+    PagedMemory text;
+    functional_memory mem;
+    for (auto &it : text_memory.mem.memory)
+        if (it.second != "") text.write8(it.first, stoul(it.second, nullptr, 16));
+    for (auto &it : data_memory.mem.memory)
+        if (it.second != "") mem.data.write8(it.first, stoul(it.second, nullptr, 16));
+
+    jit::state s;
+    for (int i = 0; i < 32; i++) s.regs[i] = stoul(registers.regs[i], nullptr, 16);
+    s.host = &mem;
+    s.load = functional_load;
+    s.store = functional_store;
+    s.budget = UINT64_MAX;
+
+    jit::engine engine(text, use_jit);
+    uint32_t pc = engine.run(s, hex_to_dec(iag.pc));
+    uint64_t executed = UINT64_MAX - s.budget;
+
+    uint32_t instr = 0;
+    if (s.fault) cout << "Error at PC " << dec_to_hex_32bit(pc) << ": " << mem.error;
+    else if (text.read(pc, 4, instr) == 4 && instr == 0x00000073) cout << "Program ended (ecall)" << endl;
+    else cout << "Stopped at PC " << dec_to_hex_32bit(pc) << ": no instruction or not supported in functional mode" << endl;
+    cout << "Instructions executed: " << executed << endl;
+    cout << "JIT: " << (engine.jit_enabled() ? to_string(engine.translated_blocks()) + " blocks translated" : string("off")) << endl;
+
+    for (int i = 0; i < 32; i++) registers.regs[i] = dec_to_hex_32bit(s.regs[i]);
+    iag.pc = dec_to_hex_32bit(pc);
+    for (uint32_t page : mem.data.pages())
+    {
+        for (uint32_t address = page; address < page + PagedMemory::PAGE_SIZE; address++)
+        {
+            if (mem.data.written(address)) data_memory.mem.memory[address] = dec_to_hex_32bit(mem.data.read8(address)).substr(6, 2);
+        }
+    }
+}
+
+// usage: sim [input.mc] [--functional] [--no-jit]
+int main(int argc, char **argv)
 {
     PMI_data data_memory; PMI_text text_memory; IAG iag; RegisterFile registers; ALU alu; buffers buffr; BranchPredictor brpre;
 
@@ -978,6 +1060,14 @@ int main()
 
     // string input_filename = "factorial.mc";
     string input_filename = "short_input.mc";
+    bool functional = false, use_jit = true;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--functional") functional = true;
+        else if (arg == "--no-jit") use_jit = false;
+        else input_filename = arg;
+    }
 
     ifstream inputFile(input_filename);
     if (!inputFile) throw invalid_argument("Unable to open file");exit;
@@ -1017,7 +1107,8 @@ int main()
     
     inputFile.close();
 
-    control.run_cycles();
+    if (functional) run_functional(text_memory, data_memory, iag, registers, use_jit);
+    else control.run_cycles();
     
 
     cout<<buffr.ifid.pc<<' '<<buffr.ifid.instr<<endl;
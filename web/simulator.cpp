@@ -11,14 +11,12 @@
 #include <bitset>
 #include <emscripten/bind.h>
 #include "assembler.cpp"
+#include "paged_memory.cpp"
+#include "isa.cpp"
+#include "block_cache.cpp"
+#include "console_ring.cpp"
 using namespace std;
 
-// Global variables for simulator state
-string rz, ry, ra, rb;
-long long int cycles = 0;
-long long int instructions = 0;
-string consoleOutput = "";
-
 // Forward declarations of classes
 struct RegisterFile;
 struct ALU;
@@ -26,25 +24,51 @@ struct PMI;
 struct IAG;
 class functions;
 class control_circuitry;
+namespace functional
+{
+    class threaded_interpreter;
+}
+
+// Simulator state that used to live in process-wide globals. Each RiscVSimulator owns one and
+// points ctx at it for the duration of every API call (see context_scope), so independent
+// simulators can coexist in one module and run on separate threads.
+struct SimContext
+{
+    string rz, ry, ra, rb;
+    long long int cycles = 0;
+    long long int instructions = 0;
+    ConsoleRing console;
+    bool running = true;
+};
 
-// Global instances that will be accessed by exported functions
-ALU *g_alu = nullptr;
-RegisterFile *g_registers = nullptr;
-PMI *g_memory = nullptr;
-IAG *g_iag = nullptr;
-control_circuitry *g_control = nullptr;
-bool g_running = true;
+thread_local SimContext *ctx = nullptr; // context of the simulator whose API call is running on this thread
+
+// Makes a simulator's context current for one API call
+struct context_scope
+{
+    SimContext *saved;
+
+    explicit context_scope(SimContext &context) : saved(ctx)
+    {
+        ctx = &context;
+    }
+
+    ~context_scope()
+    {
+        ctx = saved;
+    }
+};
 
 // Helper function to append to console output
 void appendToConsole(const string &text)
 {
-    consoleOutput += text + "\n";
+    ctx->console.append(text);
 }
 
 // Clear console output
 void clearConsole()
 {
-    consoleOutput = "";
+    ctx->console.clear();
 }
 
 // hexadecimal to integer
@@ -211,18 +235,18 @@ struct RegisterFile
     void readRS()
     {
         if (rs1 != DONT_CARE)
-            ra = regs[rs1];
+            ctx->ra = regs[rs1];
         if (rs2 != DONT_CARE)
-            rb = regs[rs2];
-        appendToConsole("=> RA: " + ra + " RB: " + rb);
+            ctx->rb = regs[rs2];
+        appendToConsole("=> RA: " + ctx->ra + " RB: " + ctx->rb);
     }
 
     void writeRD()
     {
         appendToConsole(" ");
         appendToConsole("WRITE BACK STAGE");
-        cycles++;
-        string value = ry;
+        ctx->cycles++;
+        string value = ctx->ry;
         if (rd != DONT_CARE && rd != 0)
             regs[rd] = value;
         appendToConsole("=> RD: x" + to_string(rd) + " Value: " + value);
@@ -250,62 +274,79 @@ struct RegisterFile
 
 struct ALU
 {
-    void perform_op(string operation)
+    void perform_op(isa::Op operation)
     {
-        int aVal = hex_to_dec_signed(ra);
-        int bVal = hex_to_dec_signed(rb);
-        appendToConsole("=> RA: " + ra + " RB: " + rb);
+        int aVal = hex_to_dec_signed(ctx->ra);
+        int bVal = hex_to_dec_signed(ctx->rb);
+        appendToConsole("=> RA: " + ctx->ra + " RB: " + ctx->rb);
         appendToConsole("=> Aval: " + to_string(aVal) + " Bval: " + to_string(bVal));
         int result = 0;
 
-        if (operation == "add")
+        switch (operation)
+        {
+        case isa::Op::Add:
             result = aVal + bVal;
-        else if (operation == "sub")
+            break;
+        case isa::Op::Sub:
             result = aVal - bVal;
-        else if (operation == "and")
+            break;
+        case isa::Op::And:
             result = aVal & bVal;
-        else if (operation == "or")
+            break;
+        case isa::Op::Or:
             result = aVal | bVal;
-        else if (operation == "xor")
+            break;
+        case isa::Op::Xor:
             result = aVal ^ bVal;
-        else if (operation == "sll")
+            break;
+        case isa::Op::Sll:
             result = (static_cast<unsigned>(aVal) << (bVal & 31));
-        else if (operation == "srl")
+            break;
+        case isa::Op::Srl:
             result = (static_cast<unsigned>(aVal) >> (bVal & 31));
-        else if (operation == "sra")
+            break;
+        case isa::Op::Sra:
             result = (aVal >> (bVal & 31));
-        else if (operation == "slt")
+            break;
+        case isa::Op::Slt:
             result = (aVal < bVal) ? 1 : 0;
-        else if (operation == "mul")
+            break;
+        case isa::Op::Mul:
             result = aVal * bVal;
-        else if (operation == "div")
+            break;
+        case isa::Op::Div:
             result = aVal / bVal;
-        else if (operation == "rem")
+            break;
+        case isa::Op::Rem:
             result = aVal % bVal;
-        else if (operation == "beq")
+            break;
+        case isa::Op::Beq:
             result = (aVal == bVal) ? 1 : 0;
-        else if (operation == "bne")
+            break;
+        case isa::Op::Bne:
             result = (aVal != bVal) ? 1 : 0;
-        else if (operation == "blt")
+            break;
+        case isa::Op::Blt:
             result = (aVal < bVal) ? 1 : 0;
-        else if (operation == "bge")
+            break;
+        case isa::Op::Bge:
             result = (aVal >= bVal) ? 1 : 0;
-        else
-        {
-            appendToConsole("=> Invalid ALU operation: " + operation);
-            throw invalid_argument("=> Invalid ALU operation: " + operation);
+            break;
+        default:
+            appendToConsole("=> Invalid ALU operation: " + string(isa::op_name(operation)));
+            throw invalid_argument("=> Invalid ALU operation: " + string(isa::op_name(operation)));
         }
 
-        rz = dec_to_hex_32bit(result);
+        ctx->rz = dec_to_hex_32bit(result);
     }
 };
 
 // Memory Structure
 struct Memory
 {
-    map<int, string> text;         // Text Segment
-    map<int, string> static_data;  // Static Data Segment
-    map<int, string> dynamic_data; // Dynamic Data Segment
+    PagedMemory text;         // Text Segment
+    PagedMemory static_data;  // Static Data Segment
+    PagedMemory dynamic_data; // Dynamic Data Segment
 };
 
 // PMI (Processor Memory Interface)
@@ -314,6 +355,7 @@ struct PMI
     string MAR; // Memory Address Register
     string MDR; // Memory Data Register
     Memory mem;
+    unsigned text_version = 0; // bumped on every store to the text segment
 
     PMI() : mem() {}
 
@@ -324,7 +366,7 @@ struct PMI
 
         if (address < 268435456)
         {
-            MDR = mem.text[address] + mem.text[address + 1] + mem.text[address + 2] + mem.text[address + 3]; // Loading word as instruction is always 32 bits
+            MDR = mem.text.hex(address, 4); // Loading word as instruction is always 32 bits
             if (MDR == "")
             {
                 appendToConsole("=> No instruction at this address." + MAR);
@@ -341,13 +383,13 @@ struct PMI
                 throw runtime_error("Loading double is not possible in a 32 bit register.\n");
                 break;
             case 'b':
-                MDR = mem.static_data[address];
+                MDR = mem.static_data.hex(address, 1);
                 break; // Loading byte
             case 'h':
-                MDR = mem.static_data[address] + mem.static_data[address+1];
+                MDR = mem.static_data.hex(address, 2);
                 break; // Loading half word
             default:
-                MDR = mem.static_data[address] + mem.static_data[address + 1] + mem.static_data[address + 2] + mem.static_data[address+3];
+                MDR = mem.static_data.hex(address, 4);
                 break; // Loading word by default
             }
             if (MDR == "")
@@ -363,13 +405,13 @@ struct PMI
                 throw runtime_error("Loading double is not possible in a 32 bit register.\n");
                 break;
             case 'b':
-                MDR = mem.dynamic_data[address];
+                MDR = mem.dynamic_data.hex(address, 1);
                 break; // Loading byte
             case 'h':
-                MDR = mem.dynamic_data[address] + mem.dynamic_data[address+1];
+                MDR = mem.dynamic_data.hex(address, 2);
                 break; // Loading half word
             default:
-                MDR = mem.dynamic_data[address] + mem.dynamic_data[address + 1] + mem.dynamic_data[address + 2] + mem.dynamic_data[address+3];
+                MDR = mem.dynamic_data.hex(address, 4);
                 break; // Loading word by default
             }
             if (MDR == "")
@@ -387,10 +429,8 @@ struct PMI
 
         if (address < 268435456)
         {
-            mem.text[address] = MDR.substr(0, 2);
-            mem.text[address + 1] = MDR.substr(2, 2);
-            mem.text[address + 2] = MDR.substr(4, 2);
-            mem.text[address + 3] = MDR.substr(6, 2); // Storing word as instruction is always 32 bits
+            text_version++;
+            mem.text.write_hex(address, MDR.substr(0, 8)); // Storing word as instruction is always 32 bits
         }
         else if (address < 268468224)
         {
@@ -402,17 +442,13 @@ struct PMI
                 throw runtime_error("Loading double is not possible in a 32 bit register.\n");
                 break;
             case 'b':
-                mem.static_data[address] = MDR.substr(6, 2);
+                mem.static_data.write_hex(address, MDR.substr(6, 2));
                 break; // Storing byte
             case 'h':
-                mem.static_data[address] = MDR.substr(4, 2);
-                mem.static_data[address+1] = MDR.substr(6, 2);
+                mem.static_data.write_hex(address, MDR.substr(4, 4));
                 break; // Storing half word
             default:
-                mem.static_data[address] = MDR.substr(0, 2);
-                mem.static_data[address + 1] = MDR.substr(2, 2);
-                mem.static_data[address + 2] = MDR.substr(4, 2);
-                mem.static_data[address + 3] = MDR.substr(6, 2);
+                mem.static_data.write_hex(address, MDR.substr(0, 8));
                 break; // Storing word by default
             }
         }
@@ -426,68 +462,87 @@ struct PMI
                 throw runtime_error("Loading double is not possible in a 32 bit register.\n");
                 break;
             case 'b':
-                mem.dynamic_data[address] = MDR.substr(6, 2);
+                mem.dynamic_data.write_hex(address, MDR.substr(6, 2));
                 break; // Storing byte
             case 'h':
-                mem.dynamic_data[address] = MDR.substr(4, 2);
-                mem.dynamic_data[address+1] = MDR.substr(6, 2);
+                mem.dynamic_data.write_hex(address, MDR.substr(4, 4));
                 break; // Storing half word
             default:
-                mem.dynamic_data[address] = MDR.substr(0, 2);
-                mem.dynamic_data[address + 1] = MDR.substr(2, 2);
-                mem.dynamic_data[address + 2] = MDR.substr(4, 2);
-                mem.dynamic_data[address + 3] = MDR.substr(6, 2);
+                mem.dynamic_data.write_hex(address, MDR.substr(0, 8));
                 break; // Storing word by default
             }
         }
         appendToConsole("=> Stored Data: " + MDR + " at " + MAR);
     }
 
-    // Get memory content for a specific segment
-    string getMemoryContent(string segment, int startAddr, int count)
+    PagedMemory *getSegment(const string &segment)
     {
-        map<int, string> *memSegment;
-
         if (segment == "text")
         {
-            memSegment = &mem.text;
+            return &mem.text;
         }
         else if (segment == "static")
         {
-            memSegment = &mem.static_data;
+            return &mem.static_data;
         }
         else if (segment == "dynamic")
         {
-            memSegment = &mem.dynamic_data;
+            return &mem.dynamic_data;
         }
-        else
+        return nullptr;
+    }
+
+    static string getRow(const PagedMemory &memSegment, int addr)
+    {
+        string addrHex = "0x" + dec_to_hex_32bit(addr);
+
+        string value = memSegment.hex(addr, 4);
+
+        if (value.empty())
+            value = "00000000";
+        return addrHex + ":" + value + ";";
+    }
+
+    // Get memory content for a specific segment
+    string getMemoryContent(string segment, int startAddr, int count)
+    {
+        PagedMemory *memSegment = getSegment(segment);
+        if (!memSegment)
         {
             return "Invalid segment";
         }
 
+        memSegment->take_dirty(startAddr, count + 3); // the window is up to date now
         string result = "";
         for (int i = 0; i < count; i++)
         {
-            int addr = startAddr + i ;
-            string addrHex = "0x" + dec_to_hex_32bit(addr);
+            result += getRow(*memSegment, startAddr + i);
+        }
 
-            string value = "";
-            if (addr < 268435456 && segment == "text")
-            {
-                value = (*memSegment)[addr] + (*memSegment)[addr+1] +
-                        (*memSegment)[addr + 2] + (*memSegment)[addr+3];
-            }
-            else
-            {
-                value = (*memSegment)[addr ] + (*memSegment)[addr + 1] +
-                        (*memSegment)[addr + 2] + (*memSegment)[addr + 3];
-            }
+        return result;
+    }
 
-            if (value.empty())
-                value = "00000000";
-            result += addrHex + ":" + value + ";";
+    // The rows of the window whose bytes were written since it was last shown
+    string getChangedContent(string segment, int startAddr, int count)
+    {
+        PagedMemory *memSegment = getSegment(segment);
+        if (!memSegment)
+        {
+            return "Invalid segment";
         }
 
+        string result = "";
+        int64_t start = static_cast<uint32_t>(startAddr), end = start + count;
+        int64_t next = start; // rows before this one are done
+        for (const auto &range : memSegment->take_dirty(startAddr, count + 3))
+        {
+            // a row shows the 4 bytes from its address, so the 3 rows before a change see it too
+            int64_t first = max(max<int64_t>(range.first - 3ll, next), start);
+            int64_t last = min<int64_t>(range.first + int64_t(range.second), end);
+            for (int64_t addr = first; addr < last; addr++)
+                result += getRow(*memSegment, static_cast<int>(addr));
+            next = max(next, last);
+        }
         return result;
     }
 };
@@ -531,6 +586,7 @@ class functions
 {
 public:
     string instr, opcode, rd, funct3, rs1, rs2, funct7, imm, instr_type;
+    isa::Op op = isa::Op::None; // operation assigned at decode, drives the ALU
 
     PMI &memory;
     IAG &iag;
@@ -541,111 +597,6 @@ public:
         : memory(mem), iag(iagRef), registers(reg), alu(aluRef) {}
 
 private:
-    string getInstructionType()
-    {
-        if (opcode == "0110011")
-        { // R-type
-            if (funct3 == "000" && funct7 == "0000000")
-                return "add";
-            if (funct3 == "000" && funct7 == "0100000")
-                return "sub";
-            if (funct3 == "111")
-                return "and";
-            if (funct3 == "110" && funct7 == "0000000")
-                return "or";
-            if (funct3 == "100" && funct7 == "0000000")
-                return "xor";
-            if (funct3 == "001" && funct7 == "0000000")
-                return "sll";
-            if (funct3 == "101" && funct7 == "0000000")
-                return "srl";
-            if (funct3 == "101" && funct7 == "0100000")
-                return "sra";
-            if (funct3 == "010")
-                return "slt";
-            if (funct3 == "000" && funct7 == "0000001")
-                return "mul";
-            if (funct3 == "100" && funct7 == "0000001")
-                return "div";
-            if (funct3 == "110" && funct7 == "0000001")
-                return "rem";
-        }
-        else if (opcode == "0010011")
-        { // I-type
-            if (funct3 == "000")
-                return "add";
-            if (funct3 == "111")
-                return "and";
-            if (funct3 == "110")
-                return "or";
-            if (funct3 == "100")
-                return "xor";
-            if (funct3 == "001")
-                return "sll";
-            if (funct3 == "101" && funct7 == "0000000")
-                return "srl";
-            if (funct3 == "101" && funct7 == "0100000")
-                return "sra";
-            if (funct3 == "010")
-                return "slt";
-        }
-        else if (opcode == "0000011")
-        { // Load instructions
-            if (funct3 == "000")
-                return "lb";
-            if (funct3 == "001")
-                return "lh";
-            if (funct3 == "010")
-                return "lw";
-            if (funct3 == "011")
-                return "ld";
-        }
-        else if (opcode == "0100011")
-        { // S-type (Store instructions)
-            if (funct3 == "000")
-                return "sb";
-            if (funct3 == "001")
-                return "sh";
-            if (funct3 == "010")
-                return "sw";
-            if (funct3 == "011")
-                return "sd";
-        }
-        else if (opcode == "1100011")
-        { // B-type (Branch instructions)
-            if (funct3 == "000")
-                return "beq";
-            if (funct3 == "001")
-                return "bne";
-            if (funct3 == "100")
-                return "blt";
-            if (funct3 == "101")
-                return "bge";
-        }
-        else if (opcode == "0110111")
-        { // U-type
-            return "lui";
-        }
-        else if (opcode == "0010111")
-        { // U-type
-            return "auipc";
-        }
-        else if (opcode == "1101111")
-        { // UJ-type
-            return "jal";
-        }
-        else if (opcode == "1100111")
-        { // I-type (JALR)
-            return "jalr";
-        }
-        else if (instr == "00000073")
-        { // ECALL
-            return "ecall";
-        }
-
-        return "unknown"; // If no match is found
-    }
-
     string getImmediate(const string &binaryInstr, const string &opcode)
     {
         string im_val = "";
@@ -732,7 +683,7 @@ public:
         memory.MAR = iag.pc;
         memory.load('I');
         instr = memory.MDR;
-        cycles++;
+        ctx->cycles++;
 
         appendToConsole("=> Fetched Instruction: " + instr + " from " + memory.MAR);
     }
@@ -754,9 +705,10 @@ public:
         imm = getImmediate(binaryInstr, opcode);
         imm = bin_to_hex(imm);
 
-        instr_type = getInstructionType();
+        op = isa::instruction_type(stoul(instr, nullptr, 16));
+        instr_type = op == isa::Op::Unknown && instr == "00000073" ? "ecall" : isa::op_name(op);
 
-        cycles++;
+        ctx->cycles++;
 
         appendToConsole("=> Instruction Decoded Sucessfullly");
         appendToConsole("=> Machine Code: " + memory.MDR + ", Instruction type: " + instr_type + ", Opcode: " + opcode +
@@ -764,16 +716,16 @@ public:
                         ", RS2 :" + rs2 + ", Imm :" + imm);
     }
 
-    void execute(string op)
+    void execute(isa::Op op)
     {
         appendToConsole(" ");
         appendToConsole("EXECUTE STAGE");
-        appendToConsole(op);
+        appendToConsole(isa::op_name(op));
         alu.perform_op(op);
-        cycles++;
+        ctx->cycles++;
 
-        appendToConsole("=> Executed Instruction: " + op);
-        appendToConsole("=> Result in RZ is " + rz);
+        appendToConsole("=> Executed Instruction: " + string(isa::op_name(op)));
+        appendToConsole("=> Result in RZ is " + ctx->rz);
     }
 
     void accessMemory(string address, string data, char type, bool isWrite)
@@ -791,7 +743,7 @@ public:
             memory.MAR = address;
             memory.load(type);
         }
-        cycles++;
+        ctx->cycles++;
     }
     void accessMemory(string address, char type, bool isWrite)
     {
@@ -813,7 +765,7 @@ public:
     bool step()
     {
         bool flag = true;
-        instructions++;
+        ctx->instructions++;
         try
         {
             f.fetch();
@@ -826,16 +778,16 @@ public:
             {
                 flag = false;
                 appendToConsole("=> End of the Program Encountered");
-                g_running = false;
+                ctx->running = false;
             }
             else if (opcode == "0110011")
             {
                 // R type execution instructions
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
                 f.registers.readRS();
-                f.execute(f.instr_type);
+                f.execute(f.op);
                 f.iag.compute_nextPC("", "", false, false);
-                ry = rz;
+                ctx->ry = ctx->rz;
                 f.registers.writeRD();
             }
             else if (opcode == "0010011")
@@ -843,10 +795,10 @@ public:
                 // I type execution instructions
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
                 f.registers.readRS();
-                rb = f.imm;
-                f.execute(f.instr_type);
+                ctx->rb = f.imm;
+                f.execute(f.op);
                 f.iag.compute_nextPC("", "", false, false);
-                ry = rz;
+                ctx->ry = ctx->rz;
                 f.registers.writeRD();
             }
             else if (opcode == "0000011")
@@ -854,11 +806,11 @@ public:
                 // load instructions
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
                 f.registers.readRS();
-                rb = f.imm;
-                f.execute("add");
+                ctx->rb = f.imm;
+                f.execute(isa::Op::Add);
                 f.iag.compute_nextPC("", "", false, false);
-                f.accessMemory(rz, f.instr_type.back(), false);
-                ry = f.memory.MDR;
+                f.accessMemory(ctx->rz, f.instr_type.back(), false);
+                ctx->ry = f.memory.MDR;
                 f.registers.writeRD();
             }
             else if (opcode == "0100011")
@@ -866,21 +818,21 @@ public:
                 // store instructions
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
                 f.registers.readRS();
-                string temp = rb;
-                rb = f.imm;
-                f.execute("add");
+                string temp = ctx->rb;
+                ctx->rb = f.imm;
+                f.execute(isa::Op::Add);
                 f.iag.compute_nextPC("", "", false, false);
-                f.accessMemory(rz, temp, f.instr_type.back(), true);
+                f.accessMemory(ctx->rz, temp, f.instr_type.back(), true);
             }
             else if (opcode == "1100011")
             {
                 // branch instructions
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
                 f.registers.readRS();
-                f.execute(f.instr_type);
+                f.execute(f.op);
                 appendToConsole("=> Branch Offset is: " + f.imm);
 
-                if (rz == "00000001")
+                if (ctx->rz == "00000001")
                     f.iag.compute_nextPC(f.imm, "", false, true);
                 else
                     f.iag.compute_nextPC("", "", false, false);
@@ -890,20 +842,20 @@ public:
             {
                 // lui
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
-                rz = f.imm;
+                ctx->rz = f.imm;
                 f.iag.compute_nextPC("", "", false, false);
-                ry = rz;
+                ctx->ry = ctx->rz;
                 f.registers.writeRD();
             }
             else if (opcode == "0010111")
             {
                 // auipc
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
-                ra = f.iag.pc;
-                rb = f.imm;
-                f.execute("add");
+                ctx->ra = f.iag.pc;
+                ctx->rb = f.imm;
+                f.execute(isa::Op::Add);
                 f.iag.compute_nextPC("", "", false, false);
-                ry = rz;
+                ctx->ry = ctx->rz;
                 f.registers.writeRD();
             }
             else if (opcode == "1101111")
@@ -911,7 +863,7 @@ public:
                 // jal
                 f.registers.setAddresses(stoi(f.rs1, nullptr, 2), stoi(f.rs2, nullptr, 2), stoi(f.rd, nullptr, 2));
 
-                ry = dec_to_hex_32bit(hex_to_dec(f.iag.pc) + 4);
+                ctx->ry = dec_to_hex_32bit(hex_to_dec(f.iag.pc) + 4);
                 f.iag.compute_nextPC(f.imm, "", false, true);
                 f.registers.writeRD();
             }
@@ -923,13 +875,13 @@ public:
 
                 string temp = dec_to_hex_32bit(hex_to_dec(f.iag.pc) + 4);
 
-                rb = f.imm;
-                f.execute("add");
-                f.iag.compute_nextPC("", rz, true, false);
-                appendToConsole("=> RA, RB, Imm, RD -> " + ra + " " + rb + " " + f.imm + " " + f.rd);
-                appendToConsole("=> Imm value " + f.imm + " is added to RS2 " + rb + " to get Return Address " + rz + " and the Next Address " + temp + " is stored to " + ra);
+                ctx->rb = f.imm;
+                f.execute(isa::Op::Add);
+                f.iag.compute_nextPC("", ctx->rz, true, false);
+                appendToConsole("=> RA, RB, Imm, RD -> " + ctx->ra + " " + ctx->rb + " " + f.imm + " " + f.rd);
+                appendToConsole("=> Imm value " + f.imm + " is added to RS2 " + ctx->rb + " to get Return Address " + ctx->rz + " and the Next Address " + temp + " is stored to " + ctx->ra);
 
-                rz = temp;
+                ctx->rz = temp;
                 f.registers.writeRD();
             }
         }
@@ -952,53 +904,458 @@ public:
     }
 };
 
+// Fast functional engine. The loaded text segment is translated once into threaded code: one
+// thread_op per word holding a handler pointer and the operands already extracted, so a step
+// is a table lookup plus an indirect call. Whole basic blocks run from the block cache when
+// the step budget covers them; the threaded code handles the rest. It produces the same
+// register, memory, pc, cycle and instruction results as control_circuitry but writes nothing
+// to the console per instruction.
+namespace functional
+{
+    struct machine;
+    struct thread_op;
+    typedef uint32_t (*handler)(machine &m, const thread_op &op, uint32_t pc); // returns the next pc
+
+    struct thread_op
+    {
+        handler run = nullptr;
+        isa::Op op = isa::Op::None;
+        uint8_t rd = 0, rs1 = 0, rs2 = 0;
+        uint8_t cycles = 0;     // cycles control_circuitry counts for this instruction
+        uint8_t fail_cycles = 0; // cycles counted before a failing memory access or ALU op
+        uint32_t imm = 0;
+    };
+
+    struct machine
+    {
+        uint32_t regs[32] = {};
+        uint32_t ry = 0; // jalr writes back whatever the previous instruction left in ry
+        bool stop = false;
+        bool ended = false;
+        PMI *memory = nullptr;
+
+        const blocks::micro_op *at = nullptr; // micro-op the block executor is running
+
+        void write(uint8_t rd, uint32_t value)
+        {
+            ry = value;
+            if (rd != 0)
+                regs[rd] = value;
+        }
+
+        // the error paths go through PMI so messages match the logging engine
+        [[noreturn]] void fail_load(uint32_t address, char type)
+        {
+            memory->MAR = dec_to_hex_32bit(address);
+            memory->load(type);
+            throw runtime_error("No instruction at this address.\n");
+        }
+
+        uint32_t load(uint32_t address, char type)
+        {
+            int32_t signed_address = static_cast<int32_t>(address);
+            uint32_t value = 0;
+            if (signed_address < 268435456)
+            {
+                if (memory->mem.text.read(address, 4, value) == 0)
+                    fail_load(address, type);
+                return value;
+            }
+            if (type == 'd')
+                fail_load(address, type);
+
+            PagedMemory &segment = signed_address < 268468224 ? memory->mem.static_data : memory->mem.dynamic_data;
+            segment.read(address, type == 'b' ? 1 : type == 'h' ? 2 : 4, value);
+            return value;
+        }
+
+        void store(uint32_t address, uint32_t value, char type)
+        {
+            int32_t signed_address = static_cast<int32_t>(address);
+            if (signed_address < 268435456)
+            {
+                memory->mem.text.write(address, value, 4);
+                memory->text_version++;
+                stop = true; // the code just changed, retranslate before the next instruction
+                return;
+            }
+            if (type == 'd')
+            {
+                memory->MAR = dec_to_hex_32bit(address);
+                memory->MDR = dec_to_hex_32bit(value);
+                memory->store(type);
+            }
+
+            PagedMemory &segment = signed_address < 268468224 ? memory->mem.static_data : memory->mem.dynamic_data;
+            segment.write(address, value, type == 'b' ? 1 : type == 'h' ? 2 : 4);
+        }
+
+        // block executor interface, see block_cache.cpp
+        uint32_t link(uint32_t return_address)
+        {
+            return at->kind == blocks::UOp::Jal ? return_address : ry;
+        }
+
+        uint32_t load(const blocks::micro_op &op, uint32_t address)
+        {
+            return load(address, op.funct3 == 0 ? 'b' : op.funct3 == 1 ? 'h' : 'w');
+        }
+
+        void store(const blocks::micro_op &op, uint32_t address, uint32_t value)
+        {
+            store(address, value, op.funct3 == 0 ? 'b' : op.funct3 == 1 ? 'h' : 'w');
+        }
+
+        void retire(const blocks::micro_op &op)
+        {
+            static const uint8_t cost[] = {4, 4, 5, 4, 3, 3, 3, 3, 3, 4, 3, 4, 7, 8, 7, 7, 7, 7};
+            ctx->instructions += op.count;
+            ctx->cycles += cost[static_cast<int>(op.kind)];
+        }
+    };
+
+    uint32_t alu(isa::Op op, uint32_t a, uint32_t b)
+    {
+        uint32_t result;
+        if (!isa::compute(op, a, b, result))
+        {
+            appendToConsole("=> Invalid ALU operation: " + string(isa::op_name(op)));
+            throw invalid_argument("=> Invalid ALU operation: " + string(isa::op_name(op)));
+        }
+        return result;
+    }
+
+    uint32_t run_r(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, alu(op.op, m.regs[op.rs1], m.regs[op.rs2]));
+        return pc + 4;
+    }
+
+    uint32_t run_i(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, alu(op.op, m.regs[op.rs1], op.imm));
+        return pc + 4;
+    }
+
+    // control_circuitry picks the access width from the last letter of the instruction type,
+    // so funct3 values without a name ("unknown") access a word
+    char access_type(isa::Op op, isa::Op byte, isa::Op half, isa::Op dbl)
+    {
+        return op == byte ? 'b' : op == half ? 'h' : op == dbl ? 'd' : 'w';
+    }
+
+    uint32_t run_load(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, m.load(m.regs[op.rs1] + op.imm, access_type(op.op, isa::Op::Lb, isa::Op::Lh, isa::Op::Ld)));
+        return pc + 4;
+    }
+
+    uint32_t run_store(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.store(m.regs[op.rs1] + op.imm, m.regs[op.rs2], access_type(op.op, isa::Op::Sb, isa::Op::Sh, isa::Op::Sd));
+        return pc + 4;
+    }
+
+    uint32_t run_beq(machine &m, const thread_op &op, uint32_t pc)
+    {
+        return m.regs[op.rs1] == m.regs[op.rs2] ? pc + op.imm : pc + 4;
+    }
+
+    uint32_t run_bne(machine &m, const thread_op &op, uint32_t pc)
+    {
+        return m.regs[op.rs1] != m.regs[op.rs2] ? pc + op.imm : pc + 4;
+    }
+
+    uint32_t run_blt(machine &m, const thread_op &op, uint32_t pc)
+    {
+        return static_cast<int32_t>(m.regs[op.rs1]) < static_cast<int32_t>(m.regs[op.rs2]) ? pc + op.imm : pc + 4;
+    }
+
+    uint32_t run_bge(machine &m, const thread_op &op, uint32_t pc)
+    {
+        return static_cast<int32_t>(m.regs[op.rs1]) >= static_cast<int32_t>(m.regs[op.rs2]) ? pc + op.imm : pc + 4;
+    }
+
+    // branch with an unnamed funct3: the ALU rejects it
+    uint32_t run_bad_branch(machine &, const thread_op &op, uint32_t pc)
+    {
+        alu(op.op, 0, 0);
+        return pc + 4;
+    }
+
+    uint32_t run_lui(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, op.imm);
+        return pc + 4;
+    }
+
+    uint32_t run_auipc(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, pc + op.imm);
+        return pc + 4;
+    }
+
+    uint32_t run_jal(machine &m, const thread_op &op, uint32_t pc)
+    {
+        m.write(op.rd, pc + 4);
+        return pc + op.imm;
+    }
+
+    uint32_t run_jalr(machine &m, const thread_op &op, uint32_t)
+    {
+        uint32_t target = m.regs[op.rs1] + op.imm;
+        m.write(op.rd, m.ry);
+        return target;
+    }
+
+    uint32_t run_ecall(machine &m, const thread_op &, uint32_t pc)
+    {
+        m.stop = true;
+        m.ended = true;
+        return pc;
+    }
+
+    uint32_t run_unknown(machine &m, const thread_op &, uint32_t pc)
+    {
+        m.stop = true;
+        throw runtime_error("Unsupported instruction at " + dec_to_hex_32bit(pc));
+    }
+
+    thread_op translate(uint32_t instr)
+    {
+        thread_op t;
+        t.op = isa::instruction_type(instr);
+        t.rd = (instr >> 7) & 0x1F;
+        t.rs1 = (instr >> 15) & 0x1F;
+        t.rs2 = (instr >> 20) & 0x1F;
+        t.imm = isa::immediate(instr);
+        t.fail_cycles = 2;
+
+        switch (instr & 0x7F)
+        {
+        case isa::OP_R:
+            t.run = run_r;
+            t.cycles = 4;
+            break;
+        case isa::OP_I:
+            t.run = run_i;
+            t.cycles = 4;
+            break;
+        case isa::OP_LOAD:
+            t.run = run_load;
+            t.cycles = 5;
+            t.fail_cycles = 3;
+            break;
+        case isa::OP_STORE:
+            t.run = run_store;
+            t.cycles = 4;
+            t.fail_cycles = 3;
+            break;
+        case isa::OP_BRANCH:
+            t.run = t.op == isa::Op::Beq ? run_beq : t.op == isa::Op::Bne ? run_bne : t.op == isa::Op::Blt ? run_blt : t.op == isa::Op::Bge ? run_bge : run_bad_branch;
+            t.cycles = 3;
+            break;
+        case isa::OP_LUI:
+            t.run = run_lui;
+            t.cycles = 3;
+            break;
+        case isa::OP_AUIPC:
+            t.run = run_auipc;
+            t.cycles = 4;
+            break;
+        case isa::OP_JAL:
+            t.run = run_jal;
+            t.cycles = 3;
+            break;
+        case isa::OP_JALR:
+            t.run = run_jalr;
+            t.cycles = 4;
+            break;
+        case 0x73:
+            t.run = run_ecall;
+            t.cycles = 2;
+            break;
+        default:
+            t.run = run_unknown;
+            break;
+        }
+        return t;
+    }
+
+    class threaded_interpreter
+    {
+        vector<thread_op> code; // indexed by (pc - base) / 4, run == nullptr where nothing is loaded
+        uint32_t base = 0;
+        unsigned version = 0;
+        bool built = false;
+        blocks::block_cache block_cache; // straight-line runs, used whenever the step budget allows
+
+        void retranslate(const PagedMemory &text)
+        {
+            code.clear();
+            vector<uint32_t> pages = text.pages();
+            while (!pages.empty() && pages.back() >= 0x10000000)
+                pages.pop_back();
+            if (pages.empty())
+                return;
+
+            base = pages.front();
+            code.resize((pages.back() - base + PagedMemory::PAGE_SIZE) / 4);
+            for (uint32_t page : pages)
+            {
+                for (uint32_t address = page; address < page + PagedMemory::PAGE_SIZE; address += 4)
+                {
+                    uint32_t instr;
+                    if (text.read(address, 4, instr) == 4)
+                        code[(address - base) / 4] = translate(instr);
+                }
+            }
+        }
+
+    public:
+        machine m;
+
+        // Executes up to max_steps instructions on the state held by the logging engine's
+        // objects. Returns false once the program ended or an error stopped it.
+        bool execute(RegisterFile &registers, IAG &iag, PMI &memory, uint64_t max_steps)
+        {
+            m.memory = &memory;
+            m.ended = false;
+            for (int i = 0; i < 32; i++)
+                m.regs[i] = registers.regs[i].empty() ? 0 : stoul(registers.regs[i], nullptr, 16);
+            m.ry = ctx->ry.empty() ? 0 : stoul(ctx->ry, nullptr, 16);
+            uint32_t pc = stoul(iag.pc, nullptr, 16);
+
+            bool ok = true;
+            bool in_block = false;
+            const thread_op *op = nullptr;
+            try
+            {
+                while (max_steps > 0 && !m.ended)
+                {
+                    if (!built || version != memory.text_version)
+                    {
+                        retranslate(memory.mem.text);
+                        version = memory.text_version;
+                        built = true;
+                    }
+
+                    m.stop = false;
+                    while (max_steps > 0 && !m.stop)
+                    {
+                        const blocks::block &b = block_cache.lookup(pc, memory.mem.text, memory.text_version);
+                        if (!b.ops.empty() && b.count <= max_steps)
+                        {
+                            uint64_t before = ctx->instructions;
+                            in_block = true;
+                            pc = blocks::execute(m, b);
+                            in_block = false;
+                            max_steps -= ctx->instructions - before;
+                            continue;
+                        }
+
+                        uint32_t offset = pc - base;
+                        op = nullptr;
+                        ctx->instructions++;
+                        if ((offset & 3) || offset / 4 >= code.size() || !code[offset / 4].run)
+                            m.fail_load(pc, 'I'); // a partially written word is not executed either
+
+                        op = &code[offset / 4];
+                        pc = op->run(m, *op, pc);
+                        ctx->cycles += op->cycles;
+                        max_steps--;
+                    }
+                }
+            }
+            catch (const exception &e)
+            {
+                if (in_block)
+                {
+                    // only loads and stores fail inside a block, after 3 cycles
+                    pc = m.at->pc;
+                    ctx->instructions++;
+                    ctx->cycles += 3;
+                }
+                else if (op)
+                    ctx->cycles += op->fail_cycles;
+                appendToConsole("=> Error: " + string(e.what()));
+                ok = false;
+            }
+
+            for (int i = 0; i < 32; i++)
+                registers.regs[i] = dec_to_hex_32bit(m.regs[i]);
+            ctx->ry = dec_to_hex_32bit(m.ry);
+            iag.pc = dec_to_hex_32bit(pc);
+
+            if (m.ended)
+            {
+                appendToConsole("=> End of the Program Encountered");
+                ctx->running = false;
+                return false;
+            }
+            return ok;
+        }
+    };
+}
+
 // Class to expose to JavaScript
 class RiscVSimulator
 {
 public:
-    RiscVSimulator() : initialized(false) {}
+    RiscVSimulator() : initialized(false), engine("reference") {}
+
+    ~RiscVSimulator()
+    {
+        cleanup();
+    }
+
+    RiscVSimulator(const RiscVSimulator &) = delete;
+    RiscVSimulator &operator=(const RiscVSimulator &) = delete;
     
     string assemble(const string &code) {
+        context_scope scope(context);
         appendToConsole("=> Assembling code...");
         return ::assemble(code);
     }
 
     void init()
     {
+        context_scope scope(context);
         if (initialized)
         {
             cleanup();
         }
         clearConsole();
 
-        g_alu = new ALU();
-        g_registers = new RegisterFile();
-        g_memory = new PMI();
-        g_iag = new IAG();
-        g_control = new control_circuitry(*g_alu, *g_registers, *g_memory, *g_iag);
-        g_running = true;
-        cycles = 0;
-        instructions = 0;
+        memory = new PMI();
+        newProcessor();
+        if (engine == "fast")
+            functional_engine = new functional::threaded_interpreter();
+        restart();
         initialized = true;
+        program_loaded = false;
 
         appendToConsole("=> Simulator initialized");
     }
 
     void cleanup()
     {
+        context_scope scope(context);
         if (initialized)
         {
-            delete g_alu;
-            delete g_registers;
-            delete g_memory;
-            delete g_iag;
-            delete g_control;
-
-            g_alu = nullptr;
-            g_registers = nullptr;
-            g_memory = nullptr;
-            g_iag = nullptr;
-            g_control = nullptr;
+            delete alu;
+            delete registers;
+            delete memory;
+            delete iag;
+            delete control;
+            delete functional_engine;
+
+            alu = nullptr;
+            registers = nullptr;
+            memory = nullptr;
+            iag = nullptr;
+            control = nullptr;
+            functional_engine = nullptr;
 
             initialized = false;
         }
@@ -1006,6 +1363,7 @@ public:
 
     void loadCode(const string &codeStr)
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
@@ -1029,9 +1387,9 @@ public:
             {
                 string addr = line.substr(2, 8);
                 string code = "000000" + line.substr(11, 2);
-                g_memory->MAR = addr;
-                g_memory->MDR = code;
-                g_memory->store('b');
+                memory->MAR = addr;
+                memory->MDR = code;
+                memory->store('b');
             }
             else
             {
@@ -1045,106 +1403,243 @@ public:
                 instrStr = instrStr.substr(2, instrStr.find_first_of(' ') - 2);
 
                 // Store in memory
-                g_memory->MAR = addrStr;
-                g_memory->MDR = instrStr;
-                g_memory->store('w');
+                memory->MAR = addrStr;
+                memory->MDR = instrStr;
+                memory->store('w');
             }
         }
 
+        loaded = memory->mem; // shares the pages until the program writes them
+        loaded_text_version = memory->text_version;
+        program_loaded = true;
         appendToConsole("=> Code loaded successfully");
     }
 
     bool step()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        if (!g_running)
+        if (!ctx->running)
         {
             appendToConsole("=> Simulation has ended");
             return false;
         }
 
-        return g_control->step();
+        if (functional_engine)
+            return functional_engine->execute(*registers, *iag, *memory, 1);
+        return control->step();
     }
 
     void run()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        if (!g_running)
+        if (!ctx->running)
         {
             appendToConsole("=> Simulation has ended");
             return;
         }
 
-        g_control->run();
+        if (functional_engine)
+            functional_engine->execute(*registers, *iag, *memory, UINT64_MAX);
+        else
+            control->run();
     }
 
     void reset()
     {
+        context_scope scope(context);
         cleanup();
         init();
         appendToConsole("=> Simulator reset");
     }
 
+    // Starts the loaded program over without parsing it again: memory goes back to how loadCode
+    // left it and the registers to their initial values. The engine and its translated text are
+    // kept unless the program wrote to the text segment.
+    void resetState()
+    {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        if (!program_loaded)
+        {
+            throw runtime_error("No program loaded");
+        }
+
+        clearConsole();
+        if (memory->text_version != loaded_text_version)
+        {
+            memory->mem.text = loaded.text;
+            loaded_text_version = ++memory->text_version;
+        }
+        memory->mem.static_data = loaded.static_data;
+        memory->mem.dynamic_data = loaded.dynamic_data;
+        memory->mem.text.mark_all_dirty();
+        memory->mem.static_data.mark_all_dirty();
+        memory->mem.dynamic_data.mark_all_dirty();
+        newProcessor();
+        restart();
+        appendToConsole("=> Simulator reset");
+    }
+
     string showReg()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        return g_registers->getAllRegisters();
+        return registers->getAllRegisters();
     }
 
     string showMem(const string &segment, int startAddr, int count)
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        return g_memory->getMemoryContent(segment, startAddr, count);
+        return memory->getMemoryContent(segment, startAddr, count);
+    }
+
+    // Like showMem, but only the rows written since that window was last shown, so a memory
+    // view can stay live during long runs. The first call after loadCode reports the program.
+    // Changes are tracked per 64 byte line, so it suits one live view per segment: windows
+    // sharing a line take each other's changes.
+    string showMemChanges(const string &segment, int startAddr, int count)
+    {
+        context_scope scope(context);
+        if (!initialized)
+        {
+            throw runtime_error("Simulator not initialized");
+        }
+
+        return memory->getChangedContent(segment, startAddr, count);
     }
 
     string getPC()
     {
+        context_scope scope(context);
         if (!initialized)
         {
             throw runtime_error("Simulator not initialized");
         }
 
-        return g_iag->getPC();
+        return iag->getPC();
     }
 
+    // every line still held, see readConsoleSince for polling
     string getConsoleOutput()
     {
-        return consoleOutput;
+        context_scope scope(context);
+        return ctx->console.read_all();
+    }
+
+    // The console lines after cursor (0 for the first call, then the cursor of the previous
+    // chunk) and how many of them were lost to the ring before they could be read
+    ConsoleChunk readConsoleSince(double cursor)
+    {
+        context_scope scope(context);
+        uint64_t dropped;
+        ConsoleChunk chunk;
+        chunk.text = ctx->console.read_since(cursor < 0 ? 0 : static_cast<uint64_t>(cursor), dropped);
+        chunk.cursor = static_cast<double>(ctx->console.cursor());
+        chunk.dropped = static_cast<double>(dropped);
+        return chunk;
     }
 
     void clearConsoleOutput()
     {
+        context_scope scope(context);
         clearConsole();
     }
 
     int getCycleCount()
     {
-        return cycles;
+        context_scope scope(context);
+        return ctx->cycles;
     }
 
     int getInstructionCount()
     {
-        return instructions;
+        context_scope scope(context);
+        return ctx->instructions;
+    }
+
+    // "reference" logs every stage of every instruction, "fast" runs translated code without
+    // per-instruction logging. Both keep the same registers, memory, pc and counters, so the
+    // engine can be switched at any point.
+    void setEngine(const string &mode)
+    {
+        context_scope scope(context);
+        if (mode != "fast" && mode != "reference")
+        {
+            throw invalid_argument("Unknown engine: " + mode);
+        }
+        engine = mode;
+
+        if (initialized)
+        {
+            delete functional_engine;
+            functional_engine = engine == "fast" ? new functional::threaded_interpreter() : nullptr;
+        }
+    }
+
+    string getEngine()
+    {
+        context_scope scope(context);
+        return engine;
     }
 
 private:
     bool initialized;
+    string engine;
+
+    SimContext context;
+    ALU *alu = nullptr;
+    RegisterFile *registers = nullptr;
+    PMI *memory = nullptr;
+    IAG *iag = nullptr;
+    control_circuitry *control = nullptr;
+    functional::threaded_interpreter *functional_engine = nullptr; // set while the fast engine is selected
+    Memory loaded; // memory as loadCode left it, for resetState
+    unsigned loaded_text_version = 0;
+    bool program_loaded = false;
+
+    // (Re)creates everything but the memory and the engine
+    void newProcessor()
+    {
+        delete alu;
+        delete registers;
+        delete iag;
+        delete control;
+        alu = new ALU();
+        registers = new RegisterFile();
+        iag = new IAG();
+        control = new control_circuitry(*alu, *registers, *memory, *iag);
+    }
+
+    void restart()
+    {
+        ctx->running = true;
+        ctx->cycles = 0;
+        ctx->instructions = 0;
+        ctx->rz = ctx->ry = ctx->ra = ctx->rb = "";
+    }
 };
 
 // Binding our C++ class to JavaScript
@@ -1152,6 +1647,11 @@ EMSCRIPTEN_BINDINGS(riscv_simulator)
 {
     using namespace emscripten;
 
+    value_object<ConsoleChunk>("ConsoleChunk")
+        .field("text", &ConsoleChunk::text)
+        .field("cursor", &ConsoleChunk::cursor)
+        .field("dropped", &ConsoleChunk::dropped);
+
     class_<RiscVSimulator>("RiscVSimulator")
         .constructor<>()
         .function("init", &RiscVSimulator::init)
@@ -1160,12 +1660,17 @@ EMSCRIPTEN_BINDINGS(riscv_simulator)
         .function("step", &RiscVSimulator::step)
         .function("run", &RiscVSimulator::run)
         .function("reset", &RiscVSimulator::reset)
+        .function("resetState", &RiscVSimulator::resetState)
         .function("showReg", &RiscVSimulator::showReg)
         .function("showMem", &RiscVSimulator::showMem)
+        .function("showMemChanges", &RiscVSimulator::showMemChanges)
         .function("getPC", &RiscVSimulator::getPC)
         .function("getConsoleOutput", &RiscVSimulator::getConsoleOutput)
+        .function("readConsoleSince", &RiscVSimulator::readConsoleSince)
         .function("clearConsoleOutput", &RiscVSimulator::clearConsoleOutput)
         .function("getCycleCount", &RiscVSimulator::getCycleCount)
         .function("assemble", &RiscVSimulator::assemble)
-        .function("getInstructionCount", &RiscVSimulator::getInstructionCount);
+        .function("getInstructionCount", &RiscVSimulator::getInstructionCount)
+        .function("setEngine", &RiscVSimulator::setEngine)
+        .function("getEngine", &RiscVSimulator::getEngine);
 }
\ No newline at end of file
@@ -0,0 +1,227 @@
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+// Breakpoints and watchpoints of a simulator. The engines report every fetch, register write and
+// store through the hooks below while armed is set, and the run loops stop after a cycle that
+// set hit. Fetches are looked up in a hash of breakpoint pcs, register writes are only compared
+// when the register has a condition and stores only when their page is in the watch bitmap, so
+// the checks cost a test of armed when nothing is set.
+struct Watchpoints
+{
+    enum class Cmp : uint8_t
+    {
+        Eq, Ne, Lt, Le, Gt, Ge
+    };
+
+    struct RegisterCondition
+    {
+        int id;
+        uint8_t reg;
+        Cmp cmp;
+        int32_t value; // compared signed
+    };
+
+    struct DataRange
+    {
+        int id;
+        uint32_t start, size;
+    };
+
+    static const uint32_t PAGE_BITS = 12;
+
+    bool armed = false;
+    bool hit = false;
+    string reason; // of the first hit since the last reset_hit()
+
+    // id of the new breakpoint, or of the one already at pc
+    int add_breakpoint(uint32_t pc)
+    {
+        auto it = pcs.find(pc);
+        if (it != pcs.end())
+            return it->second;
+        pcs[pc] = next_id;
+        armed = true;
+        return next_id++;
+    }
+
+    int add_condition(uint8_t reg, Cmp cmp, int32_t value)
+    {
+        conditions.push_back({next_id, reg, cmp, value});
+        watched_regs |= 1u << reg;
+        armed = true;
+        return next_id++;
+    }
+
+    int add_range(uint32_t start, uint32_t size)
+    {
+        ranges.push_back({next_id, start, size});
+        mark_pages(ranges.back());
+        armed = true;
+        return next_id++;
+    }
+
+    bool remove(int id)
+    {
+        bool found = false;
+        for (auto it = pcs.begin(); it != pcs.end(); ++it)
+            if (it->second == id)
+            {
+                pcs.erase(it);
+                found = true;
+                break;
+            }
+        for (size_t i = 0; i < conditions.size(); i++)
+            if (conditions[i].id == id)
+            {
+                conditions.erase(conditions.begin() + i);
+                found = true;
+                break;
+            }
+        for (size_t i = 0; i < ranges.size(); i++)
+            if (ranges[i].id == id)
+            {
+                ranges.erase(ranges.begin() + i);
+                found = true;
+                break;
+            }
+        if (found)
+            rebuild();
+        return found;
+    }
+
+    void clear()
+    {
+        pcs.clear();
+        conditions.clear();
+        ranges.clear();
+        rebuild();
+    }
+
+    void reset_hit()
+    {
+        hit = false;
+        reason.clear();
+    }
+
+    void fetched(uint32_t pc)
+    {
+        auto it = pcs.find(pc);
+        if (it != pcs.end())
+            trigger("breakpoint " + to_string(it->second) + " at pc " + hex(pc));
+    }
+
+    void wrote_register(uint8_t reg, uint32_t value)
+    {
+        if (!(watched_regs >> reg & 1))
+            return;
+        for (const RegisterCondition &c : conditions)
+            if (c.reg == reg && holds(c.cmp, static_cast<int32_t>(value), c.value))
+                trigger("watch " + to_string(c.id) + ": x" + to_string(reg) + " " + cmp_name(c.cmp) + " " + to_string(c.value) +
+                        " (x" + to_string(reg) + " = " + to_string(static_cast<int32_t>(value)) + ")");
+    }
+
+    void stored(uint32_t address, uint32_t size)
+    {
+        if (pages.empty() || (!page_watched(address) && !page_watched(address + size - 1)))
+            return;
+        for (const DataRange &r : ranges)
+            if (address - r.start < r.size || r.start - address < size)
+                trigger("watch " + to_string(r.id) + ": store of " + to_string(size) + " bytes at " + hex(address));
+    }
+
+    static bool parse_cmp(const string &text, Cmp &cmp)
+    {
+        static const char *const names[] = {"==", "!=", "<", "<=", ">", ">="};
+        for (int i = 0; i < 6; i++)
+            if (text == names[i])
+            {
+                cmp = static_cast<Cmp>(i);
+                return true;
+            }
+        return false;
+    }
+
+private:
+    unordered_map<uint32_t, int> pcs; // breakpoint pc -> id
+    vector<RegisterCondition> conditions;
+    uint32_t watched_regs = 0; // bit per register that has a condition
+    vector<DataRange> ranges;
+    vector<uint64_t> pages; // bit per 4 KiB page touched by a range, empty without ranges
+    int next_id = 1;
+
+    static const char *cmp_name(Cmp cmp)
+    {
+        static const char *const names[] = {"==", "!=", "<", "<=", ">", ">="};
+        return names[static_cast<int>(cmp)];
+    }
+
+    static bool holds(Cmp cmp, int32_t a, int32_t b)
+    {
+        switch (cmp)
+        {
+        case Cmp::Eq:
+            return a == b;
+        case Cmp::Ne:
+            return a != b;
+        case Cmp::Lt:
+            return a < b;
+        case Cmp::Le:
+            return a <= b;
+        case Cmp::Gt:
+            return a > b;
+        default:
+            return a >= b;
+        }
+    }
+
+    static string hex(uint32_t value)
+    {
+        static const char digits[] = "0123456789ABCDEF";
+        string s(8, '0');
+        for (int i = 7; i >= 0; i--, value >>= 4)
+            s[i] = digits[value & 15];
+        return s;
+    }
+
+    void trigger(const string &why)
+    {
+        if (!hit)
+            reason = why;
+        hit = true;
+    }
+
+    bool page_watched(uint32_t address) const
+    {
+        uint32_t page = address >> PAGE_BITS;
+        return pages[page >> 6] >> (page & 63) & 1;
+    }
+
+    void mark_pages(const DataRange &r)
+    {
+        if (pages.empty())
+            pages.resize((1u << (32 - PAGE_BITS)) / 64);
+        uint32_t first = r.start >> PAGE_BITS;
+        uint32_t last = static_cast<uint32_t>((uint64_t(r.start) + r.size - 1) >> PAGE_BITS) & ((1u << (32 - PAGE_BITS)) - 1);
+        for (uint32_t page = first;; page = (page + 1) & ((1u << (32 - PAGE_BITS)) - 1))
+        {
+            pages[page >> 6] |= 1ull << (page & 63);
+            if (page == last)
+                break;
+        }
+    }
+
+    void rebuild()
+    {
+        watched_regs = 0;
+        for (const RegisterCondition &c : conditions)
+            watched_regs |= 1u << c.reg;
+        pages.clear();
+        for (const DataRange &r : ranges)
+            mark_pages(r);
+        armed = !pcs.empty() || !conditions.empty() || !ranges.empty();
+    }
+};